@@ -0,0 +1,119 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <random>
+#include <vector>
+#include <string>
+
+#include "../lib/io.hpp"
+
+// Settings of a benchmark run, changed with command line flags.
+struct benchConfig {
+   std::string dbFile = "bench.db";
+   int accounts = 10000;
+   int ops = 10000;
+   int ledger = 10000;
+   int batch = 1000;
+   std::vector<int> batchSizes = {1, 100, 10000};
+   std::vector<int> historyRows = {10000, 1000000};
+   int threads = 4;
+   double zipf = 0.99;
+   unsigned long long seed = 1;
+   std::vector<std::string> workloads;
+};
+
+// Amount of heap allocations so far, counted by the operator new of the
+// benchmark.
+inline std::atomic<long long> allocations(0);
+
+// Measured latencies and totals of a single workload.
+struct benchResult {
+   std::string workload;
+   long long ops;
+   double seconds;
+   std::vector<double> latenciesUs;
+   std::map<std::string, double> extra;
+
+   benchResult(std::string workload)
+   : workload(workload), ops(0), seconds(0) {}
+
+   // Get the latency at the given percentile, between 0 and 1.
+   double percentile(double p) {
+      if (latenciesUs.empty()) return 0;
+      std::sort(latenciesUs.begin(), latenciesUs.end());
+      size_t index = std::min(latenciesUs.size() - 1,
+         size_t(p * latenciesUs.size())
+      );
+      return latenciesUs.at(index);
+   }
+
+   // Convert to a JSON object.
+   std::string json() {
+      std::string out = "{\"workload\": \"" + workload + "\", \"ops\": "
+      + std::to_string(ops) + ", \"seconds\": " + std::to_string(seconds)
+      + ", \"throughput\": " + std::to_string(seconds > 0 ? ops / seconds : 0)
+      + ", \"p50_us\": " + std::to_string(percentile(0.5))
+      + ", \"p99_us\": " + std::to_string(percentile(0.99))
+      + ", \"p999_us\": " + std::to_string(percentile(0.999));
+
+      for (auto& [key, value] : extra) {
+         out += ", \"" + key + "\": " + std::to_string(value);
+      }
+      return out + "}";
+   }
+};
+
+// Run a function the given amount of times, timing every call.
+inline benchResult measure(std::string workload, int iterations,
+std::function<void(int)> fn) {
+   benchResult result(workload);
+   result.latenciesUs.reserve(iterations);
+
+   long long allocated = allocations.load();
+   auto start = std::chrono::steady_clock::now();
+   for (int i = 0; i < iterations; i++) {
+      auto opStart = std::chrono::steady_clock::now();
+      fn(i);
+      auto opEnd = std::chrono::steady_clock::now();
+      result.latenciesUs.push_back(
+         std::chrono::duration<double, std::micro>(opEnd - opStart).count()
+      );
+   }
+   auto end = std::chrono::steady_clock::now();
+
+   result.ops = iterations;
+   result.seconds = std::chrono::duration<double>(end - start).count();
+   result.extra["allocs_per_call"] = double(allocations.load() - allocated)
+   / std::max(1, iterations);
+   return result;
+}
+
+// Picks account indexes between 0 and size - 1 with a Zipfian skew, so a few
+// accounts get most of the traffic. A skew of 0 is uniform.
+class Zipf {
+public:
+   Zipf(int size, double skew, unsigned long long seed)
+   : cdf(size), random(seed) {
+      double sum = 0;
+      for (int i = 0; i < size; i++) {
+         sum += 1 / std::pow(i + 1, skew);
+         cdf[i] = sum;
+      }
+      for (double& value : cdf) value /= sum;
+   }
+
+   // Get the next account index.
+   int next() {
+      double value = std::uniform_real_distribution<double>(0, 1)(random);
+      auto found = std::lower_bound(cdf.begin(), cdf.end(), value);
+      return std::min(int(found - cdf.begin()), int(cdf.size()) - 1);
+   }
+
+private:
+   std::vector<double> cdf;
+   std::mt19937_64 random;
+};
@@ -0,0 +1,178 @@
+#include <sys/epoll.h>
+#include <random>
+#include "bench.hpp"
+#include "../lib/network.hpp"
+
+// Password of every account made by the load test.
+const std::string LOAD_PASS = "password";
+
+// Amount of every deposit and transfer.
+const int LOAD_AMOUNT = 10;
+
+// Settings of a load test, changed with command line flags.
+struct loadConfig {
+   std::string address = "7070";
+   std::string prefix = "load";
+   int connections = 100;
+   int requests = 1000;
+   unsigned long long seed = 1;
+};
+
+// A session of the load test. Every connection signs up and logs into its
+// own account, then sends its requests one at a time.
+struct loadClient {
+   int fd, index, sent;
+   std::string input, output;
+   std::chrono::steady_clock::time_point started;
+};
+
+// Get the next command of a client: sign up, log in, then a mix of deposits,
+// balances, transfers to the other clients and history reads.
+inline std::string nextCommand(loadConfig& config, loadClient& client,
+std::mt19937_64& random) {
+   std::string name = config.prefix + str(client.index);
+   if (client.sent == 0) return "signup " + name + " " + LOAD_PASS + " 30";
+   if (client.sent == 1) return "login " + name + " " + LOAD_PASS;
+
+   int pick = random() % 100;
+   if (pick < 40) return "deposit " + str(LOAD_AMOUNT);
+   if (pick < 70) return "balance";
+   if (pick < 90) {
+      return "transfer " + config.prefix
+      + str(random() % config.connections) + " " + str(LOAD_AMOUNT / 2);
+   }
+   return "last";
+}
+
+// Queue a command and send as much as the socket takes.
+inline bool sendCommand(loadClient& client, const std::string& command) {
+   appendFrame(client.output, command);
+   client.started = std::chrono::steady_clock::now();
+
+   while (!client.output.empty()) {
+      ssize_t put = send(client.fd, client.output.data(), client.output.size(),
+      MSG_NOSIGNAL);
+      if (put > 0) client.output.erase(0, put);
+      else if (put < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+      else return false;
+   }
+   return true;
+}
+
+// Read the command line flags into config. Returns false if they are invalid.
+inline bool parseArgs(int argc, char* argv[], loadConfig& config) {
+   for (int i = 1; i < argc; i++) {
+      std::string arg = argv[i];
+      bool hasValue = i + 1 < argc;
+
+      if (arg == "--connect" && hasValue) config.address = argv[++i];
+      else if (arg == "--connections" && hasValue) {
+         config.connections = atoi(argv[++i]);
+      }
+      else if (arg == "--requests" && hasValue) config.requests = atoi(argv[++i]);
+      else if (arg == "--prefix" && hasValue) config.prefix = argv[++i];
+      else if (arg == "--seed" && hasValue) config.seed = atoll(argv[++i]);
+      else return false;
+   }
+   return config.connections > 0 && config.requests > 0;
+}
+
+// Open many sessions to a running server, see '--serve', and keep one
+// request in flight on each of them. Prints the requests per second and the
+// latencies of the requests after the logins as JSON.
+int main(int argc, char* argv[]) {
+   loadConfig config;
+   if (!parseArgs(argc, argv, config)) {
+      println("Usage: client [--connect ADDRESS] [--connections N] "
+      "[--requests N] [--prefix NAME] [--seed N]");
+      return 1;
+   }
+
+   raiseFileLimit();
+   int poll = epoll_create1(EPOLL_CLOEXEC);
+   std::vector<loadClient> clients(config.connections);
+   std::mt19937_64 random(config.seed);
+   benchResult result("server");
+   long long failed = 0, measured = 0;
+
+   for (int i = 0; i < config.connections; i++) {
+      loadClient& client = clients[i];
+      client.fd = openSocket(config.address, false);
+      if (client.fd < 0 || !setNonBlocking(client.fd)) {
+         println("Could not connect to '" + config.address + "'.", RED);
+         return 1;
+      }
+      client.index = i;
+      client.sent = 0;
+
+      epoll_event event{};
+      event.events = EPOLLIN;
+      event.data.u32 = i;
+      epoll_ctl(poll, EPOLL_CTL_ADD, client.fd, &event);
+      sendCommand(client, nextCommand(config, client, random));
+   }
+
+   // The clock starts once every session is logged in, only requests sent
+   // after that are measured. Requests queued behind logins would otherwise
+   // wait for the password hashing of other sessions.
+   int active = config.connections, loggingIn = config.connections;
+   auto start = std::chrono::steady_clock::now();
+   std::vector<epoll_event> events(config.connections);
+
+   while (active > 0) {
+      int count = epoll_wait(poll, events.data(), events.size(), -1);
+      for (int e = 0; e < count; e++) {
+         loadClient& client = clients[events[e].data.u32];
+         char chunk[64 * 1024];
+         ssize_t got = recv(client.fd, chunk, sizeof(chunk), 0);
+         if (got <= 0) {
+            if (got < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+            println("Server closed the connection.", RED);
+            return 1;
+         }
+         client.input.append(chunk, got);
+
+         size_t offset = 0;
+         std::string_view payload;
+         if (nextFrame(client.input, offset, payload) != 1) continue;
+         bool ok = !payload.empty() && payload[0] == STATUS_OK;
+         client.input.erase(0, offset);
+         client.sent++;
+
+         // Signing up fails for accounts left over from an earlier run, which
+         // is fine as long as logging in works.
+         if (client.sent == 2 && !ok) {
+            println("Could not log in as '" + config.prefix + str(client.index)
+            + "'.", RED);
+            return 1;
+         }
+         if (client.sent == 2 && --loggingIn == 0) {
+            start = std::chrono::steady_clock::now();
+         }
+         if (client.sent > 2 && loggingIn == 0 && client.started >= start) {
+            result.latenciesUs.push_back(std::chrono::duration<double,
+               std::micro>(std::chrono::steady_clock::now() - client.started)
+               .count());
+            if (!ok) failed++;
+            measured++;
+         }
+
+         if (client.sent == config.requests + 2) {
+            close(client.fd);
+            active--;
+         }
+         else if (!sendCommand(client, nextCommand(config, client, random))) {
+            println("Could not send to the server.", RED);
+            return 1;
+         }
+      }
+   }
+
+   result.seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+   result.ops = measured;
+   result.extra["connections"] = config.connections;
+   result.extra["failed"] = failed;
+   println(result.json());
+   return 0;
+}
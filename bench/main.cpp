@@ -0,0 +1,1157 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <array>
+#include <cstdlib>
+#include <new>
+#include <cstdio>
+#include <iomanip>
+#include <latch>
+#include <sstream>
+#include <thread>
+#include "bench.hpp"
+#include "../lib/archive.hpp"
+#include "../lib/backup.hpp"
+#include "../lib/columnar.hpp"
+#include "../lib/ledger.hpp"
+#include "../lib/queue.hpp"
+#include "../lib/reconcile.hpp"
+
+// Allocate and free the memory of every operator new and delete. Kept out of
+// line, so GCC does not see malloc and free paired with new and delete.
+[[gnu::noinline]] void* allocate(size_t size, size_t align) {
+   allocations.fetch_add(1, std::memory_order_relaxed);
+   void* memory = nullptr;
+   align = std::max(align, sizeof(void*));
+   if (posix_memalign(&memory, align, size ? size : 1) == 0) return memory;
+   throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void release(void* memory) noexcept {
+   free(memory);
+}
+
+// Count every heap allocation, so workloads can report allocations per op.
+void* operator new(size_t size) {
+   return allocate(size, alignof(std::max_align_t));
+}
+
+void operator delete(void* memory) noexcept {
+   release(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+   release(memory);
+}
+
+// Memory resources allocate through the aligned forms.
+void* operator new(size_t size, std::align_val_t alignment) {
+   return allocate(size, size_t(alignment));
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept {
+   release(memory);
+}
+
+void operator delete(void* memory, size_t, std::align_val_t) noexcept {
+   release(memory);
+}
+
+// Password of every seeded account.
+const std::string BENCH_PASS = "password";
+
+// Id of the seeded account with the given index, accounts are created right
+// after the BANK account in a fresh database.
+inline int accountId(int index) {
+   return BANK_ID + 1 + index;
+}
+
+// Create the accounts, give each of them money and fill the ledger with
+// transfers between them.
+inline void seed(benchConfig& config, Connection& conn, Accounts& db,
+Transactions& tr) {
+   std::string pass = hashPassword(BENCH_PASS);
+   db.createAccount(account("BANK", "BANK", MIN_AGE, Money()));
+
+   // Create accounts through the real code path, committing in chunks.
+   for (int i = 0; i < config.accounts; i += BATCH_SIZE) {
+      conn.begin();
+      for (int j = i; j < std::min(config.accounts, i + BATCH_SIZE); j++) {
+         db.createAccount(account("user" + str(j), pass, MIN_AGE,
+            Money()
+         ));
+      }
+      conn.commit();
+   }
+
+   // Fund every account so peer transfers do not run out of money.
+   std::vector<transaction> deposits;
+   for (int i = 0; i < config.accounts; i++) {
+      deposits.push_back(transaction(MAX_AMOUNT, BANK_ID, accountId(i)));
+   }
+   tr.createTransactions(deposits);
+
+   // Fill the ledger with skewed transfers.
+   Zipf zipf(config.accounts, config.zipf, config.seed);
+   std::vector<transaction> transfers;
+   for (int i = 0; i < config.ledger; i++) {
+      transfers.push_back(transaction(MIN_AMOUNT, accountId(zipf.next()),
+         accountId(zipf.next())
+      ));
+   }
+   tr.createTransactions(transfers);
+}
+
+// Compare preparing every query on each call against the statement cache.
+inline void benchStatements(benchConfig& config, Connection& conn,
+std::vector<benchResult>& results) {
+   // Skip the account cache, so every lookup runs the query.
+   Accounts db(conn, 0);
+   sqlite3* raw = conn.handle();
+   Zipf zipf(config.accounts, config.zipf, config.seed);
+
+   results.push_back(measure("statements_uncached", config.ops, [&](int) {
+      std::string name = "user" + str(zipf.next());
+      sqlite3_stmt* stmt;
+      sqlite3_prepare_v2(raw,
+      "SELECT * FROM ACCOUNTS WHERE NAME = ? AND NAME <> 'DELETED';", -1,
+      &stmt, 0);
+      sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_STATIC);
+      while (sqlite3_step(stmt) == SQLITE_ROW) {}
+      sqlite3_finalize(stmt);
+   }));
+
+   results.push_back(measure("statements_cached", config.ops, [&](int) {
+      db.selectByName("user" + str(zipf.next()));
+   }));
+}
+
+// Look up accounts by name and check their password, like a login.
+inline void benchLogin(benchConfig& config, Accounts& db,
+std::vector<benchResult>& results) {
+   Zipf zipf(config.accounts, config.zipf, config.seed);
+   cacheStats before = db.accountCacheStats();
+
+   benchResult result = measure("login", config.ops, [&](int) {
+      account acc = db.selectByName("user" + str(zipf.next()));
+      if (!db.authenticate(acc, BENCH_PASS)) {
+         println("Login failed.", RED);
+      }
+   });
+
+   cacheStats after = db.accountCacheStats();
+   after.hits -= before.hits;
+   after.misses -= before.misses;
+   result.extra["account_cache_hit_rate"] = after.hitRate();
+   results.push_back(result);
+}
+
+// Hex encode a SHA256 digest through a stringstream, the way passwords used to
+// be hashed, to compare against the table codec.
+inline std::string hashStringStream(std::string prompt) {
+   digest hash = sha256(prompt);
+   std::stringstream ss;
+   for (unsigned char byte : hash) {
+      ss << std::hex << std::setw(2) << std::setfill('0') << (int)byte;
+   }
+   return ss.str();
+}
+
+// Compare the old and new password hashing paths, and the cost of PBKDF2 at
+// increasing amounts of iterations, each reported as logins per second.
+inline void benchPasswords(benchConfig& config,
+std::vector<benchResult>& results) {
+   std::string stored = hashString(BENCH_PASS);
+   digest expected = sha256(BENCH_PASS);
+   bool matched = true;
+
+   results.push_back(measure("hash_stringstream", config.ops, [&](int) {
+      matched = matched && hashStringStream(BENCH_PASS) == stored;
+   }));
+   results.push_back(measure("hash_table", config.ops, [&](int) {
+      matched = matched && hashString(BENCH_PASS) == stored;
+   }));
+   results.push_back(measure("verify_legacy_digest", config.ops, [&](int) {
+      matched = matched && verifyPassword(BENCH_PASS, stored);
+   }));
+   results.push_back(measure("compare_digest", config.ops, [&](int) {
+      matched = matched && digestEquals(sha256(BENCH_PASS), expected);
+   }));
+
+   // The KDF is slow on purpose, so run fewer of them the more it costs.
+   for (int iterations : {1000, 10000, 100000}) {
+      std::string hashed = hashPassword(BENCH_PASS, iterations);
+      int ops = std::max(10, int(config.ops * 1000LL / iterations / 10));
+
+      benchResult result = measure("verify_pbkdf2", ops, [&](int) {
+         matched = matched && verifyPassword(BENCH_PASS, hashed);
+      });
+      result.extra["iterations"] = iterations;
+      results.push_back(result);
+   }
+
+   if (!matched) println("Password hashes did not match.", RED);
+}
+
+// Deposit into skewed accounts, each deposit committed on its own.
+inline void benchDeposit(benchConfig& config, Transactions& tr,
+std::vector<benchResult>& results) {
+   Zipf zipf(config.accounts, config.zipf, config.seed);
+
+   results.push_back(measure("deposit", config.ops, [&](int) {
+      tr.createTransaction(transaction(MIN_AMOUNT, BANK_ID,
+         accountId(zipf.next())
+      ));
+   }));
+}
+
+// Send money between skewed pairs of accounts.
+inline void benchTransfer(benchConfig& config, Transactions& tr,
+std::vector<benchResult>& results) {
+   Zipf zipf(config.accounts, config.zipf, config.seed);
+
+   results.push_back(measure("transfer", config.ops, [&](int) {
+      tr.createTransaction(transaction(MIN_AMOUNT, accountId(zipf.next()),
+         accountId(zipf.next())
+      ));
+   }));
+}
+
+// Send transfers in batches of every size of the sweep, the latency is
+// measured per batch.
+inline void benchBatch(benchConfig& config, Transactions& tr,
+std::vector<benchResult>& results) {
+   for (int size : config.batchSizes) {
+      Zipf zipf(config.accounts, config.zipf, config.seed);
+      int batches = std::max(1, config.ops / size);
+
+      benchResult result = measure("batch_" + str(size), batches, [&](int) {
+         std::vector<transaction> batch;
+         for (int i = 0; i < size; i++) {
+            batch.push_back(transaction(MIN_AMOUNT, accountId(zipf.next()),
+               accountId(zipf.next())
+            ));
+         }
+         tr.createTransactions(batch);
+      });
+
+      result.ops = batches * size;
+      result.extra["batch_size"] = size;
+      results.push_back(result);
+   }
+}
+
+// List the whole history of skewed accounts, then of a single account with
+// every amount of rows of the sweep. The single accounts get a scratch file of
+// their own, so their rows do not grow the ledger of the other workloads.
+inline void benchHistory(benchConfig& config, Transactions& tr,
+std::vector<benchResult>& results) {
+   Zipf zipf(config.accounts, config.zipf, config.seed);
+   long long rows = 0;
+
+   benchResult result = measure("history", config.ops, [&](int) {
+      rows += tr.getTransactions(accountId(zipf.next())).size();
+   });
+
+   result.extra["rows_per_op"] = double(rows) / config.ops;
+   results.push_back(result);
+
+   std::string file = config.dbFile + ".history";
+   for (std::string suffix : {"", "-wal", "-shm"}) {
+      std::remove((file + suffix).c_str());
+   }
+   {
+      Connection conn(file);
+      Accounts db(conn);
+      Transactions single(conn, db);
+      db.createAccount(account("BANK", "BANK", MIN_AGE, Money()));
+
+      for (int size : config.historyRows) {
+         std::string name = "history" + str(size);
+         db.createAccount(account(name, hashPassword(BENCH_PASS), MIN_AGE,
+            Money()
+         ));
+         int id = db.selectByName(name).id;
+
+         std::vector<transaction> deposits(size,
+            transaction(MIN_AMOUNT, BANK_ID, id)
+         );
+         single.createTransactions(deposits, size);
+
+         rows = 0;
+         benchResult listed = measure("history_" + str(size), 3, [&](int) {
+            rows += single.getTransactions(id).size();
+         });
+         listed.extra["rows_per_op"] = double(rows) / 3;
+         results.push_back(listed);
+      }
+   }
+   for (std::string suffix : {"", "-wal", "-shm"}) {
+      std::remove((file + suffix).c_str());
+   }
+}
+
+// Stream the whole history of skewed accounts a page at a time, and measure
+// how long the first page of the busiest account takes.
+inline void benchStream(benchConfig& config, Transactions& tr,
+std::vector<benchResult>& results) {
+   Zipf zipf(config.accounts, config.zipf, config.seed);
+   long long rows = 0;
+
+   benchResult result = measure("history_stream", config.ops, [&](int) {
+      tr.forEachTransaction(accountId(zipf.next()), [&](const transaction&) {
+         rows++;
+      });
+   });
+   result.extra["rows_per_op"] = double(rows) / config.ops;
+   results.push_back(result);
+
+   results.push_back(measure("history_first_page", config.ops, [&](int) {
+      historyCursor cursor;
+      tr.getTransactionsPage(accountId(0), cursor);
+   }));
+}
+
+// Serve requests that look up an account and read the first page of its
+// history, with results on the heap and then in a request arena released after
+// every request. Reports arena bytes and allocations per request, and how much
+// the heap taken by the arena grew over the second half of the run.
+inline void benchArena(benchConfig& config, Connection& conn, Transactions& tr,
+std::vector<benchResult>& results) {
+   // Skip the account cache, so every lookup builds its rows.
+   Accounts db(conn, 0);
+   Zipf zipf(config.accounts, config.zipf, config.seed);
+
+   auto request = [&](std::pmr::memory_resource* memory) {
+      int id = accountId(zipf.next());
+      historyCursor cursor;
+      std::pmr::vector<account> found = db.selectById(id, "=", memory);
+      tr.getTransactionsPage(id, cursor, HISTORY_PAGE_SIZE, memory);
+   };
+
+   results.push_back(measure("arena_heap", config.ops, [&](int) {
+      request(std::pmr::get_default_resource());
+   }));
+
+   RequestArena arena;
+   long long halfway = 0;
+   benchResult result = measure("arena", config.ops, [&](int i) {
+      if (i == config.ops / 2) halfway = arena.spills().peak();
+      request(arena.resource());
+      arena.release();
+   });
+
+   const CountingResource& usage = arena.usage();
+   result.extra["arena_allocs_per_op"] = double(usage.allocations()) / config.ops;
+   result.extra["arena_bytes_per_op"] = double(usage.bytes()) / config.ops;
+   result.extra["spill_peak_bytes"] = arena.spills().peak();
+   result.extra["spill_growth_bytes"] = arena.spills().peak() - halfway;
+   results.push_back(result);
+}
+
+// Measure what timing an operation costs, on one thread and on every thread
+// recording into the same histogram at once.
+inline void benchMetrics(benchConfig& config,
+std::vector<benchResult>& results) {
+   int records = config.ops * 100;
+
+   for (int threads = 1; threads <= config.threads; threads *= 2) {
+      LatencyHistogram histogram;
+      benchResult result = measure("metrics_record", 1, [&](int) {
+         std::vector<std::thread> workers;
+         for (int t = 0; t < threads; t++) {
+            workers.emplace_back([&]() {
+               for (int i = 0; i < records; i++) {
+                  auto start = std::chrono::steady_clock::now();
+                  histogram.record(std::chrono::duration_cast<
+                     std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now() - start).count());
+               }
+            });
+         }
+         for (std::thread& worker : workers) worker.join();
+      });
+
+      result.ops = (long long)records * threads;
+      result.extra["threads"] = threads;
+      result.extra["p50_ns"] = histogram.percentile(0.5);
+      results.push_back(result);
+   }
+}
+
+// Send transfers from 1, 2, 4 and so on up to the configured amount of
+// threads, each thread using its own pooled connection.
+inline void benchConcurrent(benchConfig& config, Connection& conn, Accounts& db,
+std::vector<benchResult>& results) {
+   for (int threads = 1; threads <= config.threads; threads *= 2) {
+      ConnectionPool pool(threads, config.dbFile);
+      Transactions tr(conn, db, &pool);
+      std::vector<std::vector<double>> latencies(threads);
+      std::vector<std::thread> workers;
+      int perThread = std::max(1, config.ops / threads);
+
+      auto start = std::chrono::steady_clock::now();
+      for (int t = 0; t < threads; t++) {
+         workers.emplace_back([&, t]() {
+            Zipf zipf(config.accounts, config.zipf, config.seed + t);
+            latencies[t] = measure("", perThread, [&](int) {
+               tr.submitTransaction(transaction(MIN_AMOUNT,
+                  accountId(zipf.next()), accountId(zipf.next())
+               ));
+            }).latenciesUs;
+         });
+      }
+      for (std::thread& worker : workers) worker.join();
+      auto end = std::chrono::steady_clock::now();
+
+      benchResult result("concurrent");
+      result.ops = perThread * threads;
+      result.seconds = std::chrono::duration<double>(end - start).count();
+      for (auto& thread : latencies) {
+         result.latenciesUs.insert(result.latenciesUs.end(), thread.begin(),
+         thread.end());
+      }
+      result.extra["threads"] = threads;
+      results.push_back(result);
+   }
+}
+
+// Send durable transfers from every thread, first each committed on its own
+// through a pool opened with synchronous FULL, then through the transfer queue
+// with every thread keeping a burst of transfers in flight. Latencies run from
+// submitting a transfer until it is on disk.
+inline void benchQueue(benchConfig& config, Connection& conn, Accounts& db,
+std::vector<benchResult>& results) {
+   int threads = config.threads;
+   int perThread = std::max(1, config.ops / threads);
+   std::vector<std::vector<double>> latencies(threads);
+   std::vector<std::thread> workers;
+
+   ConnectionPool pool(threads, config.dbFile, "FULL");
+   waitWhenBusy(conn);
+   Transactions tr(conn, db, &pool);
+
+   auto start = std::chrono::steady_clock::now();
+   for (int t = 0; t < threads; t++) {
+      workers.emplace_back([&, t]() {
+         Zipf zipf(config.accounts, config.zipf, config.seed + t);
+         latencies[t] = measure("", perThread, [&](int) {
+            tr.submitTransaction(transaction(MIN_AMOUNT,
+               accountId(zipf.next()), accountId(zipf.next())
+            ));
+         }).latenciesUs;
+      });
+   }
+   for (std::thread& worker : workers) worker.join();
+
+   benchResult sync("queue_sync");
+   sync.ops = perThread * threads;
+   sync.seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+   for (auto& thread : latencies) {
+      sync.latenciesUs.insert(sync.latenciesUs.end(), thread.begin(),
+      thread.end());
+   }
+   sync.extra["threads"] = threads;
+   results.push_back(sync);
+
+   // Every thread submits a burst and waits for all of it before the next.
+   TransferQueue queue(db, config.dbFile);
+   int burst = std::min(perThread, GROUP_COMMIT_SIZE / threads + 1);
+   workers.clear();
+
+   start = std::chrono::steady_clock::now();
+   for (int t = 0; t < threads; t++) {
+      workers.emplace_back([&, t]() {
+         Zipf zipf(config.accounts, config.zipf, config.seed + t);
+         latencies[t].assign(perThread, 0);
+
+         for (int first = 0; first < perThread; first += burst) {
+            int last = std::min(perThread, first + burst);
+            std::latch done(last - first);
+            for (int i = first; i < last; i++) {
+               auto submitted = std::chrono::steady_clock::now();
+               queue.submit(transaction(MIN_AMOUNT, accountId(zipf.next()),
+                  accountId(zipf.next())), [&, t, i, submitted](transferStatus) {
+                  latencies[t][i] = std::chrono::duration<double, std::micro>(
+                     std::chrono::steady_clock::now() - submitted).count();
+                  done.count_down();
+               });
+            }
+            done.wait();
+         }
+      });
+   }
+   for (std::thread& worker : workers) worker.join();
+
+   benchResult grouped("queue");
+   grouped.ops = perThread * threads;
+   grouped.seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+   for (auto& thread : latencies) {
+      grouped.latenciesUs.insert(grouped.latenciesUs.end(), thread.begin(),
+      thread.end());
+   }
+   grouped.extra["threads"] = threads;
+   grouped.extra["commits"] = queue.commits();
+   grouped.extra["avg_group"] = double(grouped.ops)
+   / std::max<long long>(1, queue.commits());
+   results.push_back(grouped);
+}
+
+// Build the monthly summary and the top counterparties of skewed accounts,
+// then the daily statements of every account in one pass over the ledger,
+// against pulling every row into C++ and adding it up there.
+inline void benchReports(benchConfig& config, Connection& conn,
+Transactions& tr, std::vector<benchResult>& results) {
+   Zipf zipf(config.accounts, config.zipf, config.seed);
+   int64_t from = 0, to = time(nullptr) + DAY_SECONDS;
+   RequestArena arena;
+
+   results.push_back(measure("report_summary", config.ops, [&](int) {
+      arena.release();
+      tr.getSummary(accountId(zipf.next()), from, to, reportPeriod::MONTH,
+      arena.resource());
+   }));
+   results.push_back(measure("report_counterparties", config.ops, [&](int) {
+      arena.release();
+      tr.getCounterparties(accountId(zipf.next()), from, to,
+      TOP_COUNTERPARTIES, arena.resource());
+   }));
+
+   // Every transfer is counted once received and once sent.
+   long long rows = 0, groups = 0;
+   sqlite3_stmt* stmt = conn.prepare(
+      "SELECT COUNT(*), COALESCE(SUM(AMOUNT), 0) FROM TRANSACTIONS;"
+   );
+   sqlite3_step(stmt);
+   rows = sqlite3_column_int64(stmt, 0);
+   Money ledger(sqlite3_column_int64(stmt, 1)), in, out;
+   sqlite3_reset(stmt);
+
+   benchResult statements = measure("report_statements", 1, [&](int) {
+      tr.forEachStatement(from, to, reportPeriod::DAY,
+      [&](int, const periodTotal& total) {
+         in.add(total.in);
+         out.add(total.out);
+         groups++;
+      });
+   });
+   statements.ops = rows;
+   statements.extra["statements"] = groups;
+   statements.extra["matches_ledger"] = in == ledger && out == ledger;
+   results.push_back(statements);
+
+   // What a statement used to take, every row read and added up in C++.
+   std::unordered_map<int64_t, periodTotal> totals;
+   benchResult pulled = measure("report_statements_cpp", 1, [&](int) {
+      sqlite3_stmt* stmt = conn.prepare(
+         "SELECT SENDER, RECEIVER, AMOUNT, CAST(strftime('%s', DATE) AS "
+         "INTEGER) FROM TRANSACTIONS;"
+      );
+      while (sqlite3_step(stmt) == SQLITE_ROW) {
+         Money amount(sqlite3_column_int64(stmt, 2));
+         int64_t day = sqlite3_column_int64(stmt, 3) / DAY_SECONDS;
+         periodTotal& sent = totals[int64_t(sqlite3_column_int(stmt, 0)) << 32
+         | day];
+         sent.out.add(amount);
+         sent.count++;
+         periodTotal& received = totals[int64_t(sqlite3_column_int(stmt, 1))
+         << 32 | day];
+         received.in.add(amount);
+         received.count++;
+      }
+      sqlite3_reset(stmt);
+   });
+   pulled.ops = rows;
+   pulled.extra["statements"] = totals.size();
+   results.push_back(pulled);
+}
+
+// Send transfers and read the latest transaction of the sender, timed apart
+// as they wait for different things. Adds a result for each, transfers first.
+inline void benchHotPath(benchConfig& config, Transactions& tr, Zipf& zipf,
+const std::string& name, std::vector<benchResult>& results) {
+   benchResult reads(name + "_latest");
+   benchResult transfers = measure(name + "_transfer", config.ops, [&](int) {
+      int from = accountId(zipf.next());
+      tr.createTransaction(transaction(MIN_AMOUNT, from,
+         accountId(zipf.next())
+      ));
+
+      auto start = std::chrono::steady_clock::now();
+      tr.getLatestTransaction(from);
+      reads.latenciesUs.push_back(std::chrono::duration<double, std::micro>(
+         std::chrono::steady_clock::now() - start).count()
+      );
+   });
+
+   // The reads are a part of every measured call, so only their own time is
+   // taken out of the transfers.
+   for (size_t i = 0; i < reads.latenciesUs.size(); i++) {
+      transfers.latenciesUs[i] -= reads.latenciesUs[i];
+      reads.seconds += reads.latenciesUs[i] / 1e6;
+   }
+   transfers.seconds -= reads.seconds;
+   reads.ops = transfers.ops;
+   results.push_back(transfers);
+   results.push_back(reads);
+}
+
+// Send transfers and read the latest transaction of the sender while nothing
+// else runs, then again while an Archiver moves the older half of the ledger
+// into the archives. The hot path should not notice the archiving.
+inline void benchArchive(benchConfig& config, Connection& conn,
+Transactions& tr, std::vector<benchResult>& results) {
+   // Date the older half back past the age and make a checkpoint covering it.
+   Reconciler rec(conn);
+   Archives archives(conn);
+   sqlite3_exec(conn.handle(), ("UPDATE TRANSACTIONS SET DATE = datetime(DATE, "
+   "'-" + str(ARCHIVE_AGE_DAYS + 30) + " days') WHERE ID <= "
+   "(SELECT MAX(ID) / 2 FROM TRANSACTIONS);").c_str(), nullptr, nullptr,
+   nullptr);
+   rec.checkpoint();
+
+   // Archives left over from an earlier run would swallow the rows.
+   sqlite3_stmt* stmt = conn.prepare("SELECT DISTINCT CAST(substr(DATE, 1, 4) "
+   "AS INTEGER) FROM TRANSACTIONS WHERE DATE < datetime('now', '-"
+   + str(ARCHIVE_AGE_DAYS) + " days');");
+   while (sqlite3_step(stmt) == SQLITE_ROW) {
+      for (std::string suffix : {"", "-wal", "-shm"}) {
+         std::remove((archives.fileName(sqlite3_column_int(stmt, 0))
+         + suffix).c_str());
+      }
+   }
+   sqlite3_reset(stmt);
+
+   waitWhenBusy(conn);
+   Zipf zipf(config.accounts, config.zipf, config.seed);
+   auto phase = [&](const std::string& name) {
+      benchHotPath(config, tr, zipf, name, results);
+   };
+   phase("archive_idle");
+
+   Archiver archiver(config.dbFile);
+   auto start = std::chrono::steady_clock::now();
+   archiver.start();
+   phase("archive_busy");
+   archiver.stop();
+   double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+
+   benchResult& busy = results[results.size() - 2];
+   busy.extra["archived"] = archiver.moved();
+   busy.extra["batches"] = archiver.commits();
+   busy.extra["archived_per_s"] = archiver.moved() / seconds;
+
+   // Then archive the rest at full speed with nothing else running, and run
+   // the same requests on the smaller ledger.
+   Archiver drain(config.dbFile, ARCHIVE_AGE_DAYS, ARCHIVE_BATCH_SIZE * 40, 0);
+   long long moved = 0;
+   benchResult drained = measure("archive_drain", 1, [&](int) {
+      moved = drain.archiveOld();
+   });
+   drained.ops = moved;
+   drained.extra["batches"] = drain.commits();
+   results.push_back(drained);
+   phase("archive_after");
+}
+
+// Verify a backup, printing why it failed if it did.
+inline bool verifyBackup(const std::string& copy) {
+   std::vector<balanceDrift> drifts;
+   if (Backup::verify(copy, &drifts)) return true;
+
+   println("Backup '" + copy + "' did not pass verification.", RED);
+   for (balanceDrift& drift : drifts) println(drift.string(), RED);
+   return false;
+}
+
+// Send transfers and read the latest transaction of the sender while nothing
+// else runs, then again while a Backup copies the database in the background,
+// then copy it at full speed with nothing else running. Every copy has to
+// finish without restarting and pass verification.
+inline void benchBackup(benchConfig& config, Connection& conn,
+Transactions& tr, std::vector<benchResult>& results) {
+   std::string copy = config.dbFile + ".backup";
+
+   // A copy of a database that drifted could never be verified.
+   size_t drifts = Reconciler(conn).audit().size();
+   if (drifts > 0) {
+      println("Backup workload skipped, " + str(int(drifts)) + " accounts of '"
+      + config.dbFile + "' do not pass the audit.", RED);
+      return;
+   }
+
+   waitWhenBusy(conn);
+   Zipf zipf(config.accounts, config.zipf, config.seed);
+   benchHotPath(config, tr, zipf, "backup_idle", results);
+
+   // A restart shows up as fewer pages copied than in the step before.
+   long long steps = 0, restarts = 0;
+   int copied = 0, pages = 0;
+   auto progress = [&](const backupProgress& step) {
+      if (step.file != copy) return;
+      steps++;
+      if (step.copied < copied) restarts++;
+      copied = step.copied;
+      pages = step.total;
+   };
+
+   Backup background(config.dbFile);
+   auto start = std::chrono::steady_clock::now();
+   background.start(copy, progress);
+   benchHotPath(config, tr, zipf, "backup_busy", results);
+   bool ok = background.wait();
+   double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+
+   benchResult& busy = results[results.size() - 2];
+   busy.extra["pages"] = pages;
+   busy.extra["steps"] = steps;
+   busy.extra["restarts"] = restarts;
+   busy.extra["backup_s"] = seconds;
+   busy.extra["verified"] = ok && verifyBackup(copy);
+
+   // Copy as fast as the API goes, a thousand pages per step without pauses.
+   Backup unthrottled(config.dbFile, 1000, 0);
+   steps = restarts = copied = 0;
+   benchResult full = measure("backup_full", 1, [&](int) {
+      ok = unthrottled.copyTo(copy, progress);
+   });
+   full.ops = pages;
+   full.extra["steps"] = steps;
+   full.extra["restarts"] = restarts;
+   full.extra["verified"] = ok && verifyBackup(copy);
+   results.push_back(full);
+}
+
+// Amounts summed per run by the money workload.
+const int MONEY_SUM_ROWS = 1 << 20;
+
+// Sum the amounts of the ledger the way reports do, with the branchless
+// checked sum of Money, with a check after every addition and as the plain
+// int32 dollars amounts used to be. Then format amounts with Money and with
+// the std::to_string code it replaces.
+inline void benchMoney(benchConfig& config, Connection& conn,
+std::vector<benchResult>& results) {
+   std::vector<Money> amounts;
+   sqlite3_stmt* stmt = conn.prepare("SELECT AMOUNT FROM TRANSACTIONS;");
+   while (sqlite3_step(stmt) == SQLITE_ROW) {
+      amounts.push_back(Money(sqlite3_column_int64(stmt, 0)));
+   }
+   sqlite3_reset(stmt);
+   if (amounts.empty()) return;
+
+   // Repeat the ledger until there are enough rows to sum.
+   for (size_t i = 0; amounts.size() < MONEY_SUM_ROWS; i++) {
+      amounts.push_back(amounts[i]);
+   }
+   std::vector<int32_t> dollars;
+   for (Money amount : amounts) {
+      dollars.push_back(amount.cents() / CENTS_PER_DOLLAR);
+   }
+
+   int runs = std::max(1, config.ops / 100);
+   Money total, checked;
+   int64_t plain = 0;
+   results.push_back(measure("money_sum", runs, [&](int) {
+      Money::sum(amounts, total);
+   }));
+   results.push_back(measure("money_sum_checked", runs, [&](int) {
+      checked = Money();
+      for (Money amount : amounts) {
+         if (!checked.add(amount)) return;
+      }
+   }));
+   results.push_back(measure("money_sum_int32", runs, [&](int) {
+      plain = 0;
+      for (int32_t amount : dollars) plain += amount;
+   }));
+   for (size_t i = results.size() - 3; i < results.size(); i++) {
+      results[i].ops = int64_t(runs) * amounts.size();
+   }
+   results.back().extra["matches_money"] = total == checked
+   && plain * CENTS_PER_DOLLAR == total.cents();
+
+   // Format a spread of amounts into a reused line.
+   std::string line;
+   results.push_back(measure("money_format", config.ops, [&](int i) {
+      line.clear();
+      Money(int64_t(i) * 7919).appendTo(line);
+   }));
+   results.push_back(measure("money_format_string", config.ops, [&](int i) {
+      int64_t cents = int64_t(i) * 7919;
+      line = std::to_string(cents / CENTS_PER_DOLLAR) + "."
+      + (cents % CENTS_PER_DOLLAR < 10 ? "0" : "")
+      + std::to_string(cents % CENTS_PER_DOLLAR);
+   }));
+}
+
+// Audit every account against the whole ledger, then again after a checkpoint
+// and a batch of new transfers, and reconcile single accounts incrementally.
+inline void benchAudit(benchConfig& config, Connection& conn, Transactions& tr,
+std::vector<benchResult>& results) {
+   Reconciler rec(conn);
+   Zipf zipf(config.accounts, config.zipf, config.seed);
+   size_t drifts = 0;
+
+   benchResult full = measure("audit_full", 1, [&](int) {
+      drifts += rec.audit().size();
+   });
+   full.ops = config.accounts;
+   results.push_back(full);
+
+   results.push_back(measure("checkpoint", 1, [&](int) {
+      rec.checkpoint();
+   }));
+
+   std::vector<transaction> transfers;
+   for (int i = 0; i < config.batch; i++) {
+      transfers.push_back(transaction(MIN_AMOUNT, accountId(zipf.next()),
+         accountId(zipf.next())
+      ));
+   }
+   tr.createTransactions(transfers);
+
+   benchResult incremental = measure("audit_incremental", 1, [&](int) {
+      drifts += rec.audit().size();
+   });
+   incremental.ops = config.accounts;
+   incremental.extra["new_rows"] = config.batch;
+   results.push_back(incremental);
+
+   benchResult single = measure("reconcile", config.ops, [&](int) {
+      balanceDrift drift = rec.reconcile(accountId(zipf.next()));
+      if (drift.balance != drift.expected) drifts++;
+   });
+   single.extra["drifts"] = drifts;
+   results.push_back(single);
+}
+
+// Print a long colored history the way the terminal used to, one std::cout
+// write per piece with the color built on every row, against the output
+// buffer. Stdout points at /dev/null while it runs.
+inline void benchOutput(benchConfig& config,
+std::vector<benchResult>& results) {
+   transaction trans(1, accountId(0), accountId(1), MIN_AMOUNT, 1704110400,
+   "user0", "user1");
+   int rows = config.ops * 100;
+
+   flush();
+   int terminal = dup(STDOUT_FILENO);
+   int null = open("/dev/null", O_WRONLY);
+   dup2(null, STDOUT_FILENO);
+   bool colors = useColors;
+   useColors = true;
+
+   benchResult cout = measure("output_cout", 1, [&](int) {
+      for (int i = 0; i < rows; i++) {
+         std::string color = (i % 2) ? RED : GREEN;
+         std::cout << color << trans.string() << "\n" << RES;
+      }
+      std::cout.flush();
+   });
+   cout.ops = rows;
+   results.push_back(cout);
+
+   benchResult buffered = measure("output_buffered", 1, [&](int) {
+      std::string line;
+      for (int i = 0; i < rows; i++) {
+         line.clear();
+         trans.appendTo(line);
+         println(line, (i % 2) ? RED : GREEN);
+      }
+      flush();
+   });
+   buffered.ops = rows;
+   results.push_back(buffered);
+
+   useColors = colors;
+   dup2(terminal, STDOUT_FILENO);
+   close(terminal);
+   close(null);
+}
+
+// Get the sender, receiver and amount of every transaction of an account.
+inline std::vector<std::array<int64_t, 3>> ledgerHistory(Transactions& tr,
+int id, int afterId = 0) {
+   std::vector<std::array<int64_t, 3>> rows;
+   tr.forEachTransaction(id, [&](const transaction& trans) {
+      if (trans.id <= afterId) return;
+      rows.push_back({trans.fromId, trans.toId, trans.amount.cents()});
+   });
+   return rows;
+}
+
+// Send the same deposits through the SQLite ledger and the binary file ledger,
+// with and without flushing every commit, and check that both report the same
+// histories. Then scan histories with both, and send transfers from several
+// threads to the flushing file ledger.
+inline void benchLedger(benchConfig& config,
+std::vector<benchResult>& results) {
+   std::string fileName = config.dbFile + ".ledger";
+   for (std::string suffix : {"", ".idx", ".nosync", ".nosync.idx", ".db",
+   ".db-wal", ".db-shm"}) {
+      std::remove((fileName + suffix).c_str());
+   }
+
+   // The deposits change balances that the other ledgers never see, so they
+   // go to a database of their own.
+   Connection conn(fileName + ".db");
+   Accounts db(conn);
+   Transactions tr(conn, db);
+   seed(config, conn, db, tr);
+
+   FileLedger file(fileName, conn, db),
+   unsynced(fileName + ".nosync", conn, db, false);
+   Transactions trFile(conn, db, nullptr, &file);
+   Transactions trUnsynced(conn, db, nullptr, &unsynced);
+   sqlite3_stmt* stmt = conn.prepare("SELECT MAX(ID) FROM TRANSACTIONS;");
+   sqlite3_step(stmt);
+   int lastSqlite = sqlite3_column_int(stmt, 0);
+   sqlite3_reset(stmt);
+
+   std::vector<transaction> deposits;
+   Zipf zipf(config.accounts, config.zipf, config.seed);
+   for (int i = 0; i < config.ops; i++) {
+      deposits.push_back(transaction(MIN_AMOUNT, BANK_ID,
+         accountId(zipf.next())
+      ));
+   }
+
+   for (auto [name, store] : {
+      std::pair<std::string, Transactions*>("ledger_sqlite", &tr),
+      {"ledger_file", &trFile}, {"ledger_file_nosync", &trUnsynced}
+   }) {
+      results.push_back(measure(name + "_transfer", config.ops, [&](int i) {
+         store->createTransaction(deposits[i]);
+      }));
+   }
+
+   // Both ledgers must hold the same transfers in the same order.
+   bool consistent = ledgerHistory(tr, BANK_ID, lastSqlite)
+   == ledgerHistory(trFile, BANK_ID);
+   for (int i = 0; i < std::min(config.accounts, 100); i++) {
+      consistent = consistent && ledgerHistory(tr, accountId(i), lastSqlite)
+      == ledgerHistory(trFile, accountId(i));
+   }
+
+   for (auto [name, store] : {
+      std::pair<std::string, Transactions*>("ledger_sqlite", &tr),
+      {"ledger_file", &trFile}
+   }) {
+      long long rows = 0;
+      benchResult result = measure(name + "_scan", config.ops, [&](int i) {
+         store->forEachTransaction(deposits[i].toId, [&](const transaction&) {
+            rows++;
+         });
+      });
+      result.extra["rows_per_second"] = rows / result.seconds;
+      result.extra["consistent"] = consistent;
+      results.push_back(result);
+   }
+
+   ConnectionPool pool(config.threads, fileName + ".db");
+   Transactions trConcurrent(conn, db, &pool, &file);
+   std::vector<std::thread> workers;
+   int perThread = std::max(1, config.ops / config.threads);
+
+   auto start = std::chrono::steady_clock::now();
+   for (int t = 0; t < config.threads; t++) {
+      workers.emplace_back([&, t]() {
+         for (int i = 0; i < perThread; i++) {
+            trConcurrent.submitTransaction(deposits[(t * perThread + i)
+            % deposits.size()]);
+         }
+      });
+   }
+   for (std::thread& worker : workers) worker.join();
+   auto end = std::chrono::steady_clock::now();
+
+   benchResult result("ledger_file_concurrent");
+   result.ops = perThread * config.threads;
+   result.seconds = std::chrono::duration<double>(end - start).count();
+   result.extra["threads"] = config.threads;
+   results.push_back(result);
+}
+
+// Export the database into a columnar file, then sum the flows per account
+// and per day from the export and with the equivalent SQL.
+inline void benchExport(benchConfig& config, Connection& conn,
+std::vector<benchResult>& results) {
+   std::string fileName = config.dbFile + ".col";
+   Exporter exporter(conn);
+
+   benchResult exported = measure("export", 1, [&](int) {
+      exporter.exportTo(fileName);
+   });
+   ColumnarReader reader;
+   if (!reader.open(fileName)) {
+      println("Could not read export.", RED);
+      return;
+   }
+   exported.ops = reader.transactions();
+   results.push_back(exported);
+
+   int runs = std::max(1, config.ops / 1000);
+   int64_t columnar = 0, sql = 0;
+   benchResult perAccount = measure("export_flows_account", runs, [&](int) {
+      // Weigh each net flow by its account, so both sides must agree on
+      // every account and not only on the total.
+      std::vector<accountFlow> flows = reader.flowsPerAccount();
+      columnar = 0;
+      for (size_t id = 0; id < flows.size(); id++) {
+         columnar += int64_t(id) * (flows[id].in.cents()
+         - flows[id].out.cents());
+      }
+   });
+   perAccount.ops = runs * reader.transactions();
+   results.push_back(perAccount);
+
+   results.push_back(measure("export_flows_day", runs, [&](int) {
+      reader.flowsPerDay();
+   }));
+   results.back().ops = runs * reader.transactions();
+
+   sqlite3_stmt* stmt = conn.prepare(
+      "SELECT ACCOUNT, SUM(DELTA) FROM (SELECT RECEIVER AS ACCOUNT, AMOUNT AS "
+      "DELTA FROM TRANSACTIONS UNION ALL SELECT SENDER, -AMOUNT FROM "
+      "TRANSACTIONS) GROUP BY ACCOUNT;"
+   );
+   benchResult grouped = measure("sql_flows_account", runs, [&](int) {
+      sql = 0;
+      while (sqlite3_step(stmt) == SQLITE_ROW) {
+         sql += sqlite3_column_int64(stmt, 0) * sqlite3_column_int64(stmt, 1);
+      }
+      sqlite3_reset(stmt);
+   });
+   grouped.ops = runs * reader.transactions();
+   grouped.extra["matches_export"] = columnar == sql;
+   results.push_back(grouped);
+   std::remove(fileName.c_str());
+}
+
+// Compare login lookups with and without the name index. The index is dropped
+// for the scan and created again afterwards, so the workloads after this one
+// run with it.
+inline void benchIndexes(benchConfig& config, Connection& conn,
+std::vector<benchResult>& results) {
+   Accounts db(conn, 0);
+   Zipf zipf(config.accounts, config.zipf, config.seed);
+
+   results.push_back(measure("lookup_indexed", config.ops, [&](int) {
+      db.selectByName("user" + str(zipf.next()));
+   }));
+
+   sqlite3_exec(conn.handle(), "DROP INDEX ACCOUNTS_NAME;", nullptr, nullptr,
+   nullptr);
+   results.push_back(measure("lookup_scan", std::max(10, config.ops / 100),
+   [&](int) {
+      db.selectByName("user" + str(zipf.next()));
+   }));
+
+   sqlite3_exec(conn.handle(), "CREATE UNIQUE INDEX ACCOUNTS_NAME "
+   "ON ACCOUNTS(NAME) WHERE NAME <> 'DELETED';", nullptr, nullptr, nullptr);
+}
+
+// Parse the command line flags, returns false if they are invalid.
+inline bool parseArgs(int argc, char* argv[], benchConfig& config) {
+   for (int i = 1; i < argc; i++) {
+      std::string arg = argv[i];
+      bool hasValue = i + 1 < argc;
+
+      if (arg == "--db" && hasValue) config.dbFile = argv[++i];
+      else if (arg == "--accounts" && hasValue) config.accounts = atoi(argv[++i]);
+      else if (arg == "--ops" && hasValue) config.ops = atoi(argv[++i]);
+      else if (arg == "--ledger" && hasValue) config.ledger = atoi(argv[++i]);
+      else if (arg == "--batch" && hasValue) {
+         config.batch = atoi(argv[++i]);
+         config.batchSizes = {config.batch};
+      }
+      else if (arg == "--history-rows" && hasValue) {
+         config.historyRows = {atoi(argv[++i])};
+      }
+      else if (arg == "--threads" && hasValue) config.threads = atoi(argv[++i]);
+      else if (arg == "--zipf" && hasValue) config.zipf = atof(argv[++i]);
+      else if (arg == "--seed" && hasValue) config.seed = atoll(argv[++i]);
+      else if (arg == "--iterations" && hasValue) {
+         passwordIterations = atoi(argv[++i]);
+      }
+      else if (arg.rfind("--", 0) == 0) return false;
+      else config.workloads.push_back(arg);
+   }
+
+   if (config.workloads.empty()) {
+      config.workloads = {
+         "statements", "passwords", "login", "deposit", "transfer", "batch",
+         "concurrent", "history", "stream", "audit", "output", "ledger",
+         "export", "indexes", "arena", "metrics", "queue", "money",
+         "reports", "archive", "backup"
+      };
+   }
+   return config.accounts > 1 && config.ops > 0 && config.batch > 0
+   && config.threads > 0 && passwordIterations > 0
+   && config.historyRows.front() > 0;
+}
+
+// Seed a scratch database and run the chosen workloads against the real
+// Accounts and Transactions classes, printing the results as JSON.
+int main(int argc, char* argv[]) {
+   benchConfig config;
+   if (!parseArgs(argc, argv, config)) {
+      println("Usage: bench [--db FILE] [--accounts N] [--ops N] [--ledger N] "
+      "[--batch N] [--threads N] [--zipf S] [--seed N] [--iterations N] "
+      "[--history-rows N] [workload...]\n"
+      "Workloads: statements, passwords, login, deposit, transfer, batch, "
+      "concurrent, history, stream, audit, output, ledger, export, indexes, "
+      "arena, metrics, queue, money, reports, archive, backup");
+      return 1;
+   }
+
+   for (std::string suffix : {"", "-wal", "-shm"}) {
+      std::remove((config.dbFile + suffix).c_str());
+   }
+
+   Connection conn(config.dbFile);
+   Accounts db(conn);
+   Transactions tr(conn, db);
+   seed(config, conn, db, tr);
+
+   std::vector<benchResult> results;
+   for (std::string workload : config.workloads) {
+      if (workload == "statements") benchStatements(config, conn, results);
+      else if (workload == "passwords") benchPasswords(config, results);
+      else if (workload == "login") benchLogin(config, db, results);
+      else if (workload == "deposit") benchDeposit(config, tr, results);
+      else if (workload == "transfer") benchTransfer(config, tr, results);
+      else if (workload == "batch") benchBatch(config, tr, results);
+      else if (workload == "concurrent") {
+         benchConcurrent(config, conn, db, results);
+      }
+      else if (workload == "history") benchHistory(config, tr, results);
+      else if (workload == "stream") benchStream(config, tr, results);
+      else if (workload == "audit") benchAudit(config, conn, tr, results);
+      else if (workload == "output") benchOutput(config, results);
+      else if (workload == "ledger") benchLedger(config, results);
+      else if (workload == "export") benchExport(config, conn, results);
+      else if (workload == "indexes") benchIndexes(config, conn, results);
+      else if (workload == "arena") benchArena(config, conn, tr, results);
+      else if (workload == "metrics") benchMetrics(config, results);
+      else if (workload == "queue") benchQueue(config, conn, db, results);
+      else if (workload == "money") benchMoney(config, conn, results);
+      else if (workload == "reports") benchReports(config, conn, tr, results);
+      else if (workload == "archive") benchArchive(config, conn, tr, results);
+      else if (workload == "backup") benchBackup(config, conn, tr, results);
+      else println("Unknown workload '" + workload + "'.", RED);
+   }
+
+   // Print the results, followed by the operation metrics of every workload.
+   print("{\"accounts\": " + str(config.accounts) + ", \"ledger\": "
+   + str(config.ledger) + ", \"zipf\": " + std::to_string(config.zipf)
+   + ", \"results\": [\n");
+   for (size_t i = 0; i < results.size(); i++) {
+      print("  " + results[i].json() + (i + 1 < results.size() ? ",\n" : "\n"));
+   }
+   println("], \"metrics\": " + metricsJson(conn) + "}");
+   return 0;
+}
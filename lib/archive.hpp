@@ -0,0 +1,130 @@
+#pragma once
+#include <pthread.h>
+#include <sched.h>
+#include <chrono>
+#include <condition_variable>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include <string>
+
+#include "reconcile.hpp"
+
+// Age in days after which transactions are moved into the archives.
+const int ARCHIVE_AGE_DAYS = 365;
+
+// Pause between two batches in microseconds. A batch holds the write lock for
+// a few milliseconds, the pause keeps that to a small share of the time so
+// transfers rarely have to wait for it.
+const int ARCHIVE_PAUSE_US = 50000;
+
+// Seconds between two runs of the background archiver.
+const int ARCHIVE_INTERVAL_S = 3600;
+
+// Moves old transactions out of the ledger into the archives, a batch at a
+// time with a pause in between, so the ledger is only ever locked for a short
+// delete. Runs either once or in the background every interval, on a
+// connection of its own.
+class Archiver {
+public:
+   // Open a connection to the file for the archiver. Transactions older than
+   // the given amount of days are archived.
+   Archiver(const std::string& fileName = DATABASE_FILE,
+   int ageDays = ARCHIVE_AGE_DAYS, int batchSize = ARCHIVE_BATCH_SIZE,
+   int pauseUs = ARCHIVE_PAUSE_US)
+   : conn(fileName), archives(conn), rec(conn), ageDays(ageDays),
+   batchSize(std::max(1, batchSize)), pause(pauseUs), stopping(false),
+   rows(0), batches(0) {
+      waitWhenBusy(conn);
+   }
+
+   // Stop the background job, it finishes the batch it is moving first.
+   ~Archiver() {
+      stop();
+      if (worker.joinable()) worker.join();
+   }
+
+   // Move every transaction made before the cutoff, in seconds since the
+   // epoch, that is covered by the checkpoint. Returns the amount moved, or -1
+   // if a batch failed.
+   long long archiveBefore(int64_t cutoff) {
+      int last = rec.lastCheckpoint();
+      long long total = 0;
+
+      while (true) {
+         int moved = archives.moveBatch(cutoff, last, batchSize);
+         if (moved < 0) return -1;
+         if (moved == 0) return total;
+         total += moved;
+
+         {
+            std::unique_lock<std::mutex> lock(mutex);
+            rows += moved;
+            batches++;
+            if (wake.wait_for(lock, pause, [&]() { return stopping; })) {
+               return total;
+            }
+         }
+      }
+   }
+
+   // Move every transaction older than the age of the archiver.
+   long long archiveOld() {
+      return archiveBefore(time(nullptr) - ageDays * DAY_SECONDS);
+   }
+
+   // Archive old transactions in the background now and after every interval
+   // until stopped. Every run moves the checkpoint first, since only the
+   // transactions it covers are archived. The job only gets the CPU when no
+   // other thread wants it, so it never delays a request. The archiver must
+   // not be used from other threads meanwhile.
+   void start(int intervalS = ARCHIVE_INTERVAL_S) {
+      worker = std::thread([this, intervalS]() {
+         sched_param idle{};
+         pthread_setschedparam(pthread_self(), SCHED_IDLE, &idle);
+
+         std::unique_lock<std::mutex> lock(mutex);
+         while (!stopping) {
+            lock.unlock();
+            if (rec.checkpoint()) archiveOld();
+            lock.lock();
+            wake.wait_for(lock, std::chrono::seconds(intervalS),
+            [&]() { return stopping; });
+         }
+      });
+   }
+
+   // Stop archiving after the current batch, from any thread.
+   void stop() {
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         stopping = true;
+      }
+      wake.notify_all();
+   }
+
+   // Get the amount of transactions moved and the batches they took so far.
+   long long moved() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return rows;
+   }
+
+   long long commits() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return batches;
+   }
+
+private:
+   Connection conn;
+   Archives archives;
+   Reconciler rec;
+   int64_t ageDays;
+   int batchSize;
+   std::chrono::microseconds pause;
+
+   std::mutex mutex;
+   std::condition_variable wake;
+   bool stopping;
+   long long rows, batches;
+   std::thread worker;
+};
@@ -0,0 +1,84 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+
+// Initial size of a request arena, enough for the results of most commands
+// without asking the heap for more.
+const size_t ARENA_SIZE = 64 * 1024;
+
+// Passes allocations on to another resource and counts them. Safe to use from
+// several threads.
+class CountingResource : public std::pmr::memory_resource {
+public:
+   CountingResource(
+   std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+   : upstream(upstream), count(0), total(0), used(0), highest(0) {}
+
+   // Get the amount of allocations and bytes handed out so far.
+   long long allocations() const { return count; }
+   long long bytes() const { return total; }
+
+   // Get the amount of bytes currently handed out, and the most there were.
+   long long inUse() const { return used; }
+   long long peak() const { return highest; }
+
+private:
+   std::pmr::memory_resource* upstream;
+   std::atomic<long long> count, total, used, highest;
+
+   void* do_allocate(size_t bytes, size_t alignment) override {
+      void* memory = upstream->allocate(bytes, alignment);
+      count++;
+      total += bytes;
+      long long now = used += bytes;
+      long long seen = highest;
+      while (now > seen && !highest.compare_exchange_weak(seen, now)) {}
+      return memory;
+   }
+
+   void do_deallocate(void* memory, size_t bytes, size_t alignment) override {
+      upstream->deallocate(memory, bytes, alignment);
+      used -= bytes;
+   }
+
+   bool do_is_equal(const std::pmr::memory_resource& other) const
+   noexcept override {
+      return this == &other;
+   }
+};
+
+// Memory for the results of a single request. Rows and their strings are
+// bump allocated from a buffer that is reused by every request, and freed all
+// at once when the request is done. Requests that outgrow the buffer take
+// more from the heap until the next release. Not safe to share between
+// threads, every session keeps its own.
+class RequestArena {
+public:
+   RequestArena(size_t size = ARENA_SIZE)
+   : buffer(size), heap(), arena(buffer.data(), buffer.size(), &heap),
+   requests(&arena) {}
+
+   // Get the resource to allocate the results of the current request from.
+   std::pmr::memory_resource* resource() {
+      return &requests;
+   }
+
+   // Free everything allocated since the last release. Results allocated from
+   // the arena must not be used afterwards.
+   void release() {
+      arena.release();
+   }
+
+   // Get the allocations made by requests, and the ones that did not fit in
+   // the buffer and went to the heap.
+   const CountingResource& usage() const { return requests; }
+   const CountingResource& spills() const { return heap; }
+
+private:
+   std::vector<std::byte> buffer;
+   CountingResource heap;
+   std::pmr::monotonic_buffer_resource arena;
+   CountingResource requests;
+};
@@ -0,0 +1,231 @@
+#pragma once
+#include <pthread.h>
+#include <sched.h>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <string>
+
+#include "reconcile.hpp"
+
+// Pages copied by every step of a backup.
+const int BACKUP_PAGES_PER_STEP = 64;
+
+// Pause between two steps in microseconds, which leaves the disk to requests.
+const int BACKUP_PAUSE_US = 1000;
+
+// How far the copy of a single file got, in pages.
+struct backupProgress {
+   std::string file;
+   int copied, total;
+
+   backupProgress(std::string file, int copied, int total)
+   : file(file), copied(copied), total(total) {}
+
+   // Fraction of the file that was copied, between 0 and 1.
+   double fraction() const {
+      return (total > 0) ? double(copied) / total : 1;
+   }
+};
+
+// Copies the database and its archives into other files while they are in
+// use, a few pages at a time through the SQLite backup API. Every file is read
+// from a single snapshot that a read transaction of the backup's own
+// connection holds open, so writers on other connections go on and the copy
+// never has to restart. In WAL mode the snapshot only keeps the WAL from being
+// checkpointed past it until that file is copied. The connection is opened
+// without migrating or creating anything, so a backup never writes to the
+// database.
+class Backup {
+public:
+   // Open a connection to the file to back up. Every step copies the given
+   // amount of pages and is followed by the pause.
+   Backup(const std::string& fileName = DATABASE_FILE,
+   int pagesPerStep = BACKUP_PAGES_PER_STEP, int pauseUs = BACKUP_PAUSE_US)
+   : db(nullptr), fileName(fileName), pagesPerStep(std::max(1, pagesPerStep)),
+   pause(pauseUs), succeeded(false) {
+      if (sqlite3_open_v2(fileName.c_str(), &db, SQLITE_OPEN_READWRITE, nullptr)
+      != SQLITE_OK) {
+         println("Could not open database '" + fileName + "': "
+         + sqlite3_errmsg(db), RED);
+         sqlite3_close(db);
+         db = nullptr;
+         return;
+      }
+      sqlite3_busy_timeout(db, OPEN_BUSY_TIMEOUT_MS);
+   }
+
+   ~Backup() {
+      wait();
+      sqlite3_close(db);
+   }
+
+   // Copy the database into the file at path, replacing it, and every archive
+   // next to it, named like the archive is named next to the database.
+   // Progress is called after every step. Returns false if any copy failed.
+   bool copyTo(const std::string& path,
+   std::function<void(const backupProgress&)> progress = nullptr) {
+      if (db == nullptr) return false;
+
+      // The years are read before the copy, a year archived meanwhile is left
+      // for the next backup and its rows are still in the copied ledger.
+      std::vector<int> years = this->years();
+      if (!copyFile(db, path, progress)) return false;
+
+      std::string base = path;
+      if (base.ends_with(".db")) base.resize(base.size() - 3);
+      for (int year : years) {
+         sqlite3* archive = nullptr;
+         bool copied = sqlite3_open_v2(
+            Archives::fileName(fileName, year).c_str(), &archive,
+            SQLITE_OPEN_READWRITE, nullptr) == SQLITE_OK
+         && copyFile(archive, base + "-" + str(year) + ".db", progress);
+         sqlite3_close(archive);
+         if (!copied) return false;
+      }
+      return true;
+   }
+
+   // Copy in the background, on a thread that only gets the CPU when no other
+   // thread wants it, so the copy never delays a request. The backup must not
+   // be used from other threads until wait returns.
+   void start(const std::string& path,
+   std::function<void(const backupProgress&)> progress = nullptr) {
+      wait();
+      worker = std::thread([this, path, progress]() {
+         sched_param idle{};
+         pthread_setschedparam(pthread_self(), SCHED_IDLE, &idle);
+         succeeded = copyTo(path, progress);
+      });
+   }
+
+   // Wait for the background copy. Returns whether it succeeded.
+   bool wait() {
+      if (worker.joinable()) worker.join();
+      return succeeded;
+   }
+
+   // Check that a backup can be restored. Every file has to pass SQLite's
+   // integrity check, the database has to be at the current schema version
+   // and every balance has to match its checkpoint and ledger. Accounts that
+   // do not are added to drifts. Archives are not needed for the balances.
+   static bool verify(const std::string& path,
+   std::vector<balanceDrift>* drifts = nullptr) {
+      if (!intact(path)) return false;
+
+      std::string base = path;
+      if (base.ends_with(".db")) base.resize(base.size() - 3);
+
+      // Opening a connection migrates, which would change an old backup.
+      sqlite3* db = nullptr;
+      int version = -1;
+      if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE, nullptr)
+      == SQLITE_OK) {
+         sqlite3_stmt* stmt = nullptr;
+         sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &stmt, nullptr);
+         if (sqlite3_step(stmt) == SQLITE_ROW) version = sqlite3_column_int(stmt, 0);
+         sqlite3_finalize(stmt);
+      }
+      sqlite3_close(db);
+      if (version != int(MIGRATIONS.size())) {
+         println("Backup '" + path + "' has schema version " + str(version)
+         + " instead of " + str(int(MIGRATIONS.size())) + ".", RED);
+         return false;
+      }
+
+      Connection restored(path);
+      Archives copies(restored);
+      for (int year : copies.years()) {
+         if (!intact(base + "-" + str(year) + ".db")) return false;
+      }
+
+      std::vector<balanceDrift> found = Reconciler(restored).audit();
+      if (drifts != nullptr) *drifts = found;
+      return found.empty();
+   }
+
+private:
+   sqlite3* db;
+   std::string fileName;
+   int pagesPerStep;
+   std::chrono::microseconds pause;
+   bool succeeded;
+   std::thread worker;
+
+   // Get the years that have an archive, none if the database has no
+   // catalogue of archives yet.
+   std::vector<int> years() {
+      std::vector<int> found;
+      sqlite3_stmt* stmt = nullptr;
+      if (sqlite3_prepare_v2(db, "SELECT YEAR FROM ARCHIVES ORDER BY YEAR;", -1,
+      &stmt, nullptr) == SQLITE_OK) {
+         while (sqlite3_step(stmt) == SQLITE_ROW) {
+            found.push_back(sqlite3_column_int(stmt, 0));
+         }
+      }
+      sqlite3_finalize(stmt);
+      return found;
+   }
+
+   // Copy the main database of a handle into the file at path, from a single
+   // read snapshot.
+   bool copyFile(sqlite3* from, const std::string& path,
+   const std::function<void(const backupProgress&)>& progress) {
+      sqlite3* to = nullptr;
+      if (sqlite3_open(path.c_str(), &to) != SQLITE_OK) {
+         println("Could not open backup '" + path + "': " + sqlite3_errmsg(to),
+         RED);
+         sqlite3_close(to);
+         return false;
+      }
+
+      // Reading the schema starts the read transaction and pins the snapshot.
+      sqlite3_backup* backup = nullptr;
+      if (sqlite3_exec(from, "BEGIN; SELECT COUNT(*) FROM sqlite_master;",
+      nullptr, nullptr, nullptr) == SQLITE_OK) {
+         backup = sqlite3_backup_init(to, "main", from, "main");
+      }
+
+      int status = (backup != nullptr) ? SQLITE_OK : SQLITE_ERROR;
+      while (status == SQLITE_OK || status == SQLITE_BUSY
+      || status == SQLITE_LOCKED) {
+         status = sqlite3_backup_step(backup, pagesPerStep);
+         if (progress) {
+            int total = sqlite3_backup_pagecount(backup);
+            progress(backupProgress(path,
+               total - sqlite3_backup_remaining(backup), total
+            ));
+         }
+         if (status != SQLITE_DONE) std::this_thread::sleep_for(pause);
+      }
+      if (backup != nullptr) sqlite3_backup_finish(backup);
+      sqlite3_exec(from, "ROLLBACK;", nullptr, nullptr, nullptr);
+
+      if (status != SQLITE_DONE) {
+         println("Could not back up into '" + path + "': " + sqlite3_errmsg(to),
+         RED);
+      }
+      sqlite3_close(to);
+      return status == SQLITE_DONE;
+   }
+
+   // Run SQLite's integrity check on a file. It is opened for writing only so
+   // the WAL files are removed again when it is closed.
+   static bool intact(const std::string& path) {
+      sqlite3* db = nullptr;
+      bool ok = false;
+      if (sqlite3_open_v2(path.c_str(), &db, SQLITE_OPEN_READWRITE, nullptr)
+      == SQLITE_OK) {
+         sqlite3_stmt* stmt = nullptr;
+         sqlite3_prepare_v2(db, "PRAGMA integrity_check;", -1, &stmt, nullptr);
+         ok = sqlite3_step(stmt) == SQLITE_ROW && str(reinterpret_cast<const
+         char*>(sqlite3_column_text(stmt, 0))) == "ok";
+         sqlite3_finalize(stmt);
+      }
+      sqlite3_close(db);
+
+      if (!ok) println("Backup '" + path + "' is missing or corrupt.", RED);
+      return ok;
+   }
+};
@@ -0,0 +1,401 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <string>
+
+#include "database.hpp"
+
+// Marks a columnar export file, the last character is the format version.
+const char COLUMNAR_MAGIC[8] = {'B', 'A', 'N', 'K', 'C', 'O', 'L', '2'};
+
+// Columns start at multiples of this, so they can be read with aligned loads.
+const uint64_t COLUMN_ALIGNMENT = 64;
+
+// Start of a columnar export file. Every column is a plain array, the header
+// stores the amount of rows and the byte offset of every column. Names are
+// stored once each in a dictionary, accounts point at their name by index.
+// Password hashes are never exported.
+struct columnarHeader {
+   char magic[8];
+   uint64_t accounts, transactions, names, nameBytes;
+
+   // Account columns: int32 id, name index and age, balance in int64 cents.
+   uint64_t accountIds, accountNames, accountBalances, accountAges;
+
+   // Dictionary: uint32 offset of every name plus one past the end, and the
+   // characters of all names one after another.
+   uint64_t nameOffsets, nameChars;
+
+   // Transaction columns: int64 id, date in seconds since the epoch and amount
+   // in cents, int32 sender and receiver.
+   uint64_t transactionIds, senders, receivers, amounts, dates;
+};
+
+// Money moved in and out of a single account.
+struct accountFlow {
+   Money in, out;
+};
+
+// Money moved on a single day.
+struct dayFlow {
+   int64_t day, count;
+   Money volume;
+
+   dayFlow(): day(0), count(0) {}
+};
+
+// Writes the accounts and the transactions into a columnar file, so analytics
+// can read them without touching the live database.
+class Exporter : public Database {
+public:
+   // Use the given shared connection.
+   Exporter(Connection& conn) : Database(conn) {}
+
+   // Export everything into the given file. The rows are streamed straight
+   // into a memory mapping of the new file, so nothing is held per row. The
+   // file is written next to its final name and renamed once complete, and
+   // everything is read in a single read transaction, so the accounts and the
+   // transactions always match.
+   bool exportTo(const std::string& fileName) {
+      if (execute(prepare("BEGIN;")) != SQLITE_DONE) return false;
+
+      columnarHeader header;
+      memset(&header, 0, sizeof(header));
+      memcpy(header.magic, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC));
+      header.accounts = count("SELECT COUNT(*) FROM ACCOUNTS;");
+      header.transactions = count("SELECT COUNT(*) FROM TRANSACTIONS;");
+      header.names = count("SELECT COUNT(DISTINCT NAME) FROM ACCOUNTS;");
+      header.nameBytes = count(
+         "SELECT COALESCE(SUM(LENGTH(CAST(NAME AS BLOB))), 0) "
+         "FROM (SELECT DISTINCT NAME FROM ACCOUNTS);"
+      );
+
+      // Lay out the columns one after another.
+      uint64_t size = sizeof(columnarHeader);
+      auto column = [&](uint64_t& offset, uint64_t bytes) {
+         offset = align(size);
+         size = offset + bytes;
+      };
+      column(header.accountIds, header.accounts * 4);
+      column(header.accountNames, header.accounts * 4);
+      column(header.accountBalances, header.accounts * 8);
+      column(header.accountAges, header.accounts * 4);
+      column(header.nameOffsets, (header.names + 1) * 4);
+      column(header.nameChars, header.nameBytes);
+      column(header.transactionIds, header.transactions * 8);
+      column(header.dates, header.transactions * 8);
+      column(header.senders, header.transactions * 4);
+      column(header.receivers, header.transactions * 4);
+      column(header.amounts, header.transactions * 8);
+
+      std::string temporary = fileName + ".tmp";
+      int fd = open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+      void* mapping = MAP_FAILED;
+      if (fd >= 0 && ftruncate(fd, size) == 0) {
+         mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      }
+
+      bool written = mapping != MAP_FAILED
+      && write(static_cast<char*>(mapping), header);
+      execute(prepare("COMMIT;"));
+
+      if (mapping != MAP_FAILED) {
+         written = msync(mapping, size, MS_SYNC) == 0 && written;
+         munmap(mapping, size);
+      }
+      written = written && fsync(fd) == 0;
+      if (fd >= 0) close(fd);
+
+      if (!written || rename(temporary.c_str(), fileName.c_str()) != 0) {
+         println("Could not export to '" + fileName + "'.", RED);
+         std::remove(temporary.c_str());
+         return false;
+      }
+      return true;
+   }
+
+private:
+   // Round an offset up to the column alignment.
+   static uint64_t align(uint64_t offset) {
+      return (offset + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT
+      * COLUMN_ALIGNMENT;
+   }
+
+   // Run a query returning a single number.
+   uint64_t count(const std::string& sql) {
+      sqlite3_stmt* stmt = prepare(sql);
+      uint64_t value = 0;
+      if (sqlite3_step(stmt) == SQLITE_ROW) value = sqlite3_column_int64(stmt, 0);
+      sqlite3_reset(stmt);
+      return value;
+   }
+
+   // Fill the mapped file. Returns false if the tables changed size while
+   // reading, which cannot happen inside of the read transaction.
+   bool write(char* file, const columnarHeader& header) {
+      memcpy(file, &header, sizeof(header));
+
+      // Accounts, with every distinct name added to the dictionary once.
+      int32_t* ids = reinterpret_cast<int32_t*>(file + header.accountIds);
+      int32_t* names = reinterpret_cast<int32_t*>(file + header.accountNames);
+      int64_t* balances =
+      reinterpret_cast<int64_t*>(file + header.accountBalances);
+      int32_t* ages = reinterpret_cast<int32_t*>(file + header.accountAges);
+      uint32_t* offsets = reinterpret_cast<uint32_t*>(file + header.nameOffsets);
+      char* chars = file + header.nameChars;
+      std::unordered_map<std::string_view, int32_t> dictionary;
+      uint64_t row = 0, charsUsed = 0;
+
+      sqlite3_stmt* stmt = prepare(
+         "SELECT ID, NAME, BALANCE, AGE FROM ACCOUNTS ORDER BY ID;"
+      );
+      while (sqlite3_step(stmt) == SQLITE_ROW && row < header.accounts) {
+         std::string_view name(
+            reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)),
+            sqlite3_column_bytes(stmt, 1)
+         );
+
+         auto found = dictionary.find(name);
+         if (found == dictionary.end()) {
+            if (dictionary.size() >= header.names
+            || charsUsed + name.size() > header.nameBytes) {
+               break;
+            }
+            offsets[dictionary.size()] = charsUsed;
+            memcpy(chars + charsUsed, name.data(), name.size());
+
+            // Key the dictionary by the copy, the row's text goes away.
+            name = std::string_view(chars + charsUsed, name.size());
+            charsUsed += name.size();
+            found = dictionary.emplace(name, dictionary.size()).first;
+         }
+
+         ids[row] = sqlite3_column_int(stmt, 0);
+         names[row] = found->second;
+         balances[row] = sqlite3_column_int64(stmt, 2);
+         ages[row] = sqlite3_column_int(stmt, 3);
+         row++;
+      }
+      sqlite3_reset(stmt);
+      offsets[dictionary.size()] = charsUsed;
+      if (row != header.accounts || dictionary.size() != header.names) {
+         return false;
+      }
+
+      // Transactions, with the dates turned into seconds by SQLite.
+      int64_t* transactionIds =
+      reinterpret_cast<int64_t*>(file + header.transactionIds);
+      int64_t* dates = reinterpret_cast<int64_t*>(file + header.dates);
+      int32_t* senders = reinterpret_cast<int32_t*>(file + header.senders);
+      int32_t* receivers = reinterpret_cast<int32_t*>(file + header.receivers);
+      int64_t* amounts = reinterpret_cast<int64_t*>(file + header.amounts);
+      row = 0;
+
+      stmt = prepare(
+         "SELECT ID, CAST(strftime('%s', DATE) AS INTEGER), SENDER, RECEIVER, "
+         "AMOUNT FROM TRANSACTIONS ORDER BY ID;"
+      );
+      while (sqlite3_step(stmt) == SQLITE_ROW && row < header.transactions) {
+         transactionIds[row] = sqlite3_column_int64(stmt, 0);
+         dates[row] = sqlite3_column_int64(stmt, 1);
+         senders[row] = sqlite3_column_int(stmt, 2);
+         receivers[row] = sqlite3_column_int(stmt, 3);
+         amounts[row] = sqlite3_column_int64(stmt, 4);
+         row++;
+      }
+      sqlite3_reset(stmt);
+      return row == header.transactions;
+   }
+};
+
+// Reads a columnar export through a read only memory mapping. Columns are
+// handed out as spans straight into the file and the aggregations are plain
+// loops over them, which the compiler can vectorize where the work allows.
+class ColumnarReader {
+public:
+   ColumnarReader() : header{}, data(nullptr), size(0) {}
+
+   ~ColumnarReader() {
+      if (data) munmap(data, size);
+   }
+
+   // Map the file and check its header and its dictionary, returns false if
+   // it is not a valid export.
+   bool open(const std::string& fileName) {
+      int fd = ::open(fileName.c_str(), O_RDONLY);
+      if (fd < 0) return false;
+
+      struct stat info;
+      if (fstat(fd, &info) == 0 && size_t(info.st_size) >= sizeof(header)) {
+         size = info.st_size;
+         void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+         data = (mapping == MAP_FAILED) ? nullptr : static_cast<char*>(mapping);
+      }
+      close(fd);
+      if (!data) return false;
+
+      memcpy(&header, data, sizeof(header));
+
+      // Larger counts than bytes in the file would overflow the column sizes.
+      if (memcmp(header.magic, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC)) != 0
+      || header.accounts > size || header.transactions > size
+      || header.names >= size) {
+         return false;
+      }
+      uint64_t accountRows = header.accounts * 4;
+      uint64_t transactionRows = header.transactions * 4;
+      return fits(header.accountIds, accountRows)
+      && fits(header.accountNames, accountRows)
+      && fits(header.accountBalances, accountRows * 2)
+      && fits(header.accountAges, accountRows)
+      && fits(header.nameOffsets, (header.names + 1) * 4)
+      && fits(header.nameChars, header.nameBytes)
+      && fits(header.transactionIds, transactionRows * 2)
+      && fits(header.dates, transactionRows * 2)
+      && fits(header.senders, transactionRows)
+      && fits(header.receivers, transactionRows)
+      && fits(header.amounts, transactionRows * 2)
+      && namesValid();
+   }
+
+   // Get the amount of accounts and transactions.
+   size_t accounts() const { return header.accounts; }
+   size_t transactions() const { return header.transactions; }
+
+   // Get the account columns.
+   std::span<const int32_t> accountIds() const {
+      return column<int32_t>(header.accountIds, header.accounts);
+   }
+
+   std::span<const Money> balances() const {
+      return column<Money>(header.accountBalances, header.accounts);
+   }
+
+   // Get the name of the account at the given row.
+   std::string_view accountName(size_t row) const {
+      int32_t name = column<int32_t>(header.accountNames, header.accounts)[row];
+      std::span<const uint32_t> offsets =
+      column<uint32_t>(header.nameOffsets, header.names + 1);
+      return std::string_view(data + header.nameChars + offsets[name],
+      offsets[name + 1] - offsets[name]);
+   }
+
+   // Get the transaction columns.
+   std::span<const int64_t> dates() const {
+      return column<int64_t>(header.dates, header.transactions);
+   }
+
+   std::span<const int32_t> senders() const {
+      return column<int32_t>(header.senders, header.transactions);
+   }
+
+   std::span<const int32_t> receivers() const {
+      return column<int32_t>(header.receivers, header.transactions);
+   }
+
+   std::span<const Money> amounts() const {
+      return column<Money>(header.amounts, header.transactions);
+   }
+
+   // Sum every amount ever sent. Returns false if the total does not fit,
+   // which only happens if the export is corrupt.
+   bool totalVolume(Money& total) const {
+      return Money::sum(amounts(), total);
+   }
+
+   // Sum the money sent and received by every account, indexed by account id.
+   // Empty if a sum does not fit.
+   std::vector<accountFlow> flowsPerAccount() const {
+      int32_t maxId = 0;
+      for (int32_t id : accountIds()) maxId = std::max(maxId, id);
+
+      std::vector<accountFlow> flows(maxId + 1);
+      std::span<const int32_t> from = senders(), to = receivers();
+      std::span<const Money> amount = amounts();
+      bool fits = true;
+      for (size_t i = 0; i < amount.size(); i++) {
+         if (from[i] >= 0 && from[i] <= maxId) {
+            fits &= flows[from[i]].out.add(amount[i]);
+         }
+         if (to[i] >= 0 && to[i] <= maxId) fits &= flows[to[i]].in.add(amount[i]);
+      }
+      return fits ? flows : std::vector<accountFlow>();
+   }
+
+   // Sum the money moved on every day that had transactions, oldest first.
+   // Empty if a sum does not fit.
+   std::vector<dayFlow> flowsPerDay() const {
+      std::span<const int64_t> date = dates();
+      std::span<const Money> amount = amounts();
+      if (date.empty()) return {};
+
+      int64_t first = date[0], last = date[0];
+      for (int64_t seconds : date) {
+         first = std::min(first, seconds);
+         last = std::max(last, seconds);
+      }
+      first /= DAY_SECONDS;
+      last /= DAY_SECONDS;
+
+      std::vector<dayFlow> days(last - first + 1);
+      bool fits = true;
+      for (size_t i = 0; i < date.size(); i++) {
+         dayFlow& day = days[date[i] / DAY_SECONDS - first];
+         fits &= day.volume.add(amount[i]);
+         day.count++;
+      }
+      if (!fits) return {};
+
+      // Keep only the days that had transactions.
+      std::vector<dayFlow> used;
+      for (size_t i = 0; i < days.size(); i++) {
+         if (days[i].count == 0) continue;
+         days[i].day = first + i;
+         used.push_back(days[i]);
+      }
+      return used;
+   }
+
+private:
+   columnarHeader header;
+   char* data;
+   size_t size;
+
+   // Whether a column of the given size is inside of the file.
+   bool fits(uint64_t offset, uint64_t bytes) const {
+      return offset <= size && bytes <= size - offset;
+   }
+
+   // Whether every account points at a name of the dictionary and every name
+   // is within the characters of the dictionary, so accountName never reads
+   // outside of the file.
+   bool namesValid() const {
+      std::span<const uint32_t> offsets =
+      column<uint32_t>(header.nameOffsets, header.names + 1);
+      for (size_t i = 0; i < header.names; i++) {
+         if (offsets[i] > offsets[i + 1]) return false;
+      }
+      if (offsets[header.names] > header.nameBytes) return false;
+
+      std::span<const int32_t> names =
+      column<int32_t>(header.accountNames, header.accounts);
+      for (int32_t name : names) {
+         if (name < 0 || uint64_t(name) >= header.names) return false;
+      }
+      return true;
+   }
+
+   // Get a column as a span of the given type.
+   template <typename T>
+   std::span<const T> column(uint64_t offset, uint64_t rows) const {
+      return std::span<const T>(reinterpret_cast<const T*>(data + offset), rows);
+   }
+};
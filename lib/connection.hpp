@@ -0,0 +1,317 @@
+#pragma once
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <string>
+
+#include "io.hpp"
+#include "sqlite3.h"
+
+// Default location of the database file.
+const std::string DATABASE_FILE = "database/database.db";
+
+// Milliseconds a connection waits for the write lock of another one while it
+// is being opened.
+const int OPEN_BUSY_TIMEOUT_MS = 5000;
+
+// Schema migrations, applied in order. The user_version of a database file is
+// the amount of migrations that have already been applied to it. Never edit a
+// migration that was released, add a new one to the end instead.
+const std::vector<std::string> MIGRATIONS = {
+   // 1: Create the tables, files made before versioning already have them.
+   "CREATE TABLE IF NOT EXISTS ACCOUNTS("
+   "ID INTEGER PRIMARY KEY AUTOINCREMENT, "
+   "NAME TEXT NOT NULL, "
+   "PASS TEXT NOT NULL, "
+   "AGE INT NOT NULL, "
+   "BALANCE INT NOT NULL);"
+   "CREATE TABLE IF NOT EXISTS TRANSACTIONS("
+   "ID INTEGER PRIMARY KEY AUTOINCREMENT, "
+   "SENDER INTEGER NOT NULL, "
+   "RECEIVER INTEGER NOT NULL, "
+   "AMOUNT INTEGER NOT NULL, "
+   "DATE DATETIME DEFAULT CURRENT_TIMESTAMP, "
+   "FOREIGN KEY (SENDER) REFERENCES ACCOUNTS(ID), "
+   "FOREIGN KEY (RECEIVER) REFERENCES ACCOUNTS(ID));",
+
+   // 2: Index names for logins and the ledger by user and date. Deleted
+   // accounts all share the same name, so they are left out of the index. The
+   // ledger indexes cover every column read by the history queries.
+   "CREATE UNIQUE INDEX IF NOT EXISTS ACCOUNTS_NAME "
+   "ON ACCOUNTS(NAME) WHERE NAME <> 'DELETED';"
+   "CREATE INDEX IF NOT EXISTS TRANSACTIONS_SENDER "
+   "ON TRANSACTIONS(SENDER, DATE, RECEIVER, AMOUNT);"
+   "CREATE INDEX IF NOT EXISTS TRANSACTIONS_RECEIVER "
+   "ON TRANSACTIONS(RECEIVER, DATE, SENDER, AMOUNT);",
+
+   // 3: Put the id right after the date in the ledger indexes, so history
+   // pages ordered by date and id can be read straight from the index.
+   "DROP INDEX IF EXISTS TRANSACTIONS_SENDER;"
+   "DROP INDEX IF EXISTS TRANSACTIONS_RECEIVER;"
+   "CREATE INDEX TRANSACTIONS_SENDER "
+   "ON TRANSACTIONS(SENDER, DATE, ID, RECEIVER, AMOUNT);"
+   "CREATE INDEX TRANSACTIONS_RECEIVER "
+   "ON TRANSACTIONS(RECEIVER, DATE, ID, SENDER, AMOUNT);",
+
+   // 4: Balance of every account as of a point in the ledger, all rows share
+   // the same last transaction id.
+   "CREATE TABLE IF NOT EXISTS CHECKPOINTS("
+   "ACCOUNT INTEGER PRIMARY KEY, "
+   "BALANCE INT NOT NULL, "
+   "LAST_TRANSACTION INTEGER NOT NULL, "
+   "DATE DATETIME DEFAULT CURRENT_TIMESTAMP);",
+
+   // 5: Keep money in cents instead of whole dollars. The columns are already
+   // 64 bit integers, only the values change.
+   "UPDATE ACCOUNTS SET BALANCE = BALANCE * 100;"
+   "UPDATE TRANSACTIONS SET AMOUNT = AMOUNT * 100;"
+   "UPDATE CHECKPOINTS SET BALANCE = BALANCE * 100;",
+
+   // 6: Years whose old transactions were moved out of the ledger into an
+   // archive file of their own.
+   "CREATE TABLE IF NOT EXISTS ARCHIVES("
+   "YEAR INTEGER PRIMARY KEY, "
+   "DATE DATETIME DEFAULT CURRENT_TIMESTAMP);",
+
+   // 7: Records of every ledger file covered by a commit, so records written
+   // for a transaction that never committed can be told apart.
+   "CREATE TABLE IF NOT EXISTS LEDGER_FILES("
+   "NAME TEXT PRIMARY KEY, "
+   "RECORDS INTEGER NOT NULL);"
+};
+
+// Hit, miss and eviction counters of a cache.
+struct cacheStats {
+   long long hits, misses, evictions;
+
+   cacheStats(): hits(0), misses(0), evictions(0) {}
+
+   // Fraction of lookups that were served from the cache.
+   double hitRate() const {
+      return (hits + misses > 0) ? double(hits) / (hits + misses) : 0;
+   }
+};
+
+// A single connection to the database file, shared by all of the tables. Owns
+// the prepared statements, so they are only prepared once per process.
+class Connection {
+public:
+   // Open the database file in WAL mode, so readers do not block the writer.
+   // The synchronous level trades durability of the latest commits for commit
+   // latency, NORMAL is safe from corruption in WAL mode.
+   Connection(std::string fileName = DATABASE_FILE,
+   std::string synchronous = "NORMAL") {
+      int failed = sqlite3_open(fileName.c_str(), &db);
+
+      if (failed) {
+         fatal(str("Fatal error: Database could not be opened, ")
+         + sqlite3_errmsg(db), -1);
+      }
+
+      // Other connections may be writing while this one is opened, so wait for
+      // them until the file is set up. Afterwards the tables choose how to
+      // wait, see waitWhenBusy.
+      sqlite3_busy_timeout(db, OPEN_BUSY_TIMEOUT_MS);
+
+      // Enable foreign key support for transactions database.
+      sqlite3_exec(db, "PRAGMA foreign_keys = ON;", nullptr, nullptr, nullptr);
+      sqlite3_exec(db, "PRAGMA journal_mode = WAL;", nullptr, nullptr, nullptr);
+      sqlite3_exec(db, ("PRAGMA synchronous = " + synchronous + ";").c_str(),
+      nullptr, nullptr, nullptr);
+
+      migrate();
+      sqlite3_busy_timeout(db, 0);
+   }
+
+   // The handle and its cached statements cannot be shared between copies.
+   Connection(const Connection&) = delete;
+   Connection& operator=(const Connection&) = delete;
+
+   // Close the database when the class is deleted to save memory.
+   ~Connection() {
+      for (auto& [sql, stmt] : statements) {
+         sqlite3_finalize(stmt);
+      }
+      sqlite3_close(db);
+   }
+
+   // Get the raw SQLite handle.
+   sqlite3* handle() const {
+      return db;
+   }
+
+   // Get the statement cache hit and miss counters.
+   cacheStats statementStats() const {
+      return stats;
+   }
+
+   // Get a prepared statement for the given SQL. Each distinct query is only
+   // prepared once per connection, later calls reset and reuse it.
+   sqlite3_stmt* prepare(const std::string& sql) {
+      auto cached = statements.find(sql);
+      if (cached != statements.end()) {
+         stats.hits++;
+         sqlite3_reset(cached->second);
+         sqlite3_clear_bindings(cached->second);
+         return cached->second;
+      }
+
+      stats.misses++;
+      sqlite3_stmt* stmt;
+      if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0) != SQLITE_OK) {
+         fatal(str("Fatal error: Could not prepare statement, ")
+         + sqlite3_errmsg(db), -3);
+      }
+
+      statements.emplace(sql, stmt);
+      return stmt;
+   }
+
+   // Step a cached statement once and reset it so it does not hold any locks.
+   int execute(sqlite3_stmt* stmt) {
+      int status = sqlite3_step(stmt);
+      sqlite3_reset(stmt);
+      return status;
+   }
+
+   // Start a write transaction, taking the write lock right away so the
+   // statements inside of it cannot fail halfway with a busy database.
+   bool begin() {
+      return check(execute(prepare("BEGIN IMMEDIATE;")),
+      "Could not begin transaction: ");
+   }
+
+   // Commit the current transaction.
+   bool commit() {
+      return check(execute(prepare("COMMIT;")),
+      "Could not commit transaction: ");
+   }
+
+   // Undo everything done in the current transaction.
+   void rollback() {
+      execute(prepare("ROLLBACK;"));
+   }
+
+private:
+   sqlite3* db;
+   char* errorMsg;
+   std::unordered_map<std::string, sqlite3_stmt*> statements;
+   cacheStats stats;
+
+   // Print an error if a statement did not finish.
+   bool check(int status, std::string error) {
+      if (status != SQLITE_DONE) {
+         println(error + sqlite3_errmsg(db), RED);
+      }
+      return status == SQLITE_DONE;
+   }
+
+   // Get the amount of migrations applied to the database file.
+   int version() {
+      sqlite3_stmt* stmt = prepare("PRAGMA user_version;");
+      sqlite3_step(stmt);
+      int version = sqlite3_column_int(stmt, 0);
+      sqlite3_reset(stmt);
+      return version;
+   }
+
+   // Apply every migration the database file does not have yet. Each one runs
+   // in its own write transaction together with the version bump, so files
+   // are upgraded in place and several processes can open them at once. The
+   // write lock is only taken when a migration is missing.
+   void migrate() {
+      if (version() >= int(MIGRATIONS.size())) return;
+
+      while (true) {
+         if (sqlite3_exec(db, "BEGIN IMMEDIATE;", nullptr, 0, &errorMsg)
+         != SQLITE_OK) break;
+
+         // Read the version inside of the transaction, another connection
+         // might have just migrated the file.
+         int current = version();
+         if (current >= int(MIGRATIONS.size())) {
+            sqlite3_exec(db, "COMMIT;", nullptr, 0, nullptr);
+            return;
+         }
+
+         std::string sql = MIGRATIONS.at(current)
+         + "PRAGMA user_version = " + str(current + 1) + ";COMMIT;";
+         if (sqlite3_exec(db, sql.c_str(), nullptr, 0, &errorMsg) != SQLITE_OK) {
+            sqlite3_exec(db, "ROLLBACK;", nullptr, 0, nullptr);
+            break;
+         }
+      }
+
+      std::string message = str("Fatal Error: Could not migrate database: ")
+      + errorMsg;
+      sqlite3_free(errorMsg);
+      fatal(message, -2);
+   }
+};
+
+// A fixed amount of connections to the same file, so several threads can use
+// the database at once. Each connection is only used by one thread at a time.
+class ConnectionPool {
+public:
+   // A borrowed connection, given back to the pool when it goes out of scope.
+   class Lease {
+   public:
+      Lease(ConnectionPool& pool, Connection* conn): pool(pool), conn(conn) {}
+      Lease(const Lease&) = delete;
+      Lease& operator=(const Lease&) = delete;
+
+      ~Lease() {
+         pool.release(conn);
+      }
+
+      Connection& operator*() const {
+         return *conn;
+      }
+
+      Connection* operator->() const {
+         return conn;
+      }
+
+   private:
+      ConnectionPool& pool;
+      Connection* conn;
+   };
+
+   // Open the given amount of connections.
+   ConnectionPool(int size, std::string fileName = DATABASE_FILE,
+   std::string synchronous = "NORMAL") {
+      for (int i = 0; i < size; i++) {
+         connections.push_back(
+            std::make_unique<Connection>(fileName, synchronous)
+         );
+         idle.push_back(connections.back().get());
+      }
+   }
+
+   // Borrow a connection, waiting until one is free.
+   Lease acquire() {
+      std::unique_lock<std::mutex> lock(mutex);
+      available.wait(lock, [&]() { return !idle.empty(); });
+
+      Connection* conn = idle.back();
+      idle.pop_back();
+      return Lease(*this, conn);
+   }
+
+private:
+   std::mutex mutex;
+   std::condition_variable available;
+   std::vector<std::unique_ptr<Connection>> connections;
+   std::vector<Connection*> idle;
+
+   // Give a borrowed connection back.
+   void release(Connection* conn) {
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         idle.push_back(conn);
+      }
+      available.notify_one();
+   }
+};
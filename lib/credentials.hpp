@@ -0,0 +1,168 @@
+#pragma once
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+#include <array>
+#include <string>
+#include <string_view>
+
+// Size of the random salt of every password in bytes.
+const int SALT_SIZE = 16;
+
+// Default amount of PBKDF2 iterations, more is slower to crack but also slower
+// to log in.
+const int DEFAULT_ITERATIONS = 10000;
+
+// Prefix of passwords hashed with PBKDF2, older passwords are a plain SHA256
+// hex digest.
+const std::string KDF_PREFIX = "pbkdf2$";
+
+// Amount of iterations new passwords are hashed with.
+inline int passwordIterations = DEFAULT_ITERATIONS;
+
+// Raw SHA256 digest and password salt.
+using digest = std::array<unsigned char, SHA256_DIGEST_LENGTH>;
+using passwordSalt = std::array<unsigned char, SALT_SIZE>;
+
+// A salted password hash as stored in the database, written as
+// 'pbkdf2$<iterations>$<salt in hex>$<hash in hex>'.
+struct credential {
+   int iterations;
+   passwordSalt salt;
+   digest hash;
+
+   credential(): iterations(0), salt{}, hash{} {}
+};
+
+// Convert bytes to lowercase hex, two characters per byte.
+inline std::string toHex(const unsigned char* data, size_t size) {
+   static const char DIGITS[] = "0123456789abcdef";
+   std::string hex(size * 2, '0');
+
+   for (size_t i = 0; i < size; i++) {
+      hex[i * 2] = DIGITS[data[i] >> 4];
+      hex[i * 2 + 1] = DIGITS[data[i] & 15];
+   }
+   return hex;
+}
+
+// Convert hex to exactly size bytes, returns false if it is not valid hex of
+// that length.
+inline bool fromHex(std::string_view hex, unsigned char* out, size_t size) {
+   // Value of every hex digit, -1 for any other character.
+   static const std::array<signed char, 256> VALUES = [] {
+      std::array<signed char, 256> values;
+      values.fill(-1);
+      for (int i = 0; i < 10; i++) values['0' + i] = i;
+      for (int i = 0; i < 6; i++) values['a' + i] = values['A' + i] = 10 + i;
+      return values;
+   }();
+
+   if (hex.size() != size * 2) return false;
+
+   for (size_t i = 0; i < size; i++) {
+      int high = VALUES[(unsigned char)hex[i * 2]];
+      int low = VALUES[(unsigned char)hex[i * 2 + 1]];
+      if (high < 0 || low < 0) return false;
+      out[i] = (high << 4) | low;
+   }
+   return true;
+}
+
+// Get the SHA256 digest of a string.
+inline digest sha256(std::string_view text) {
+   digest hash;
+   SHA256((const unsigned char*)text.data(), text.size(), hash.data());
+   return hash;
+}
+
+// Compare two digests in constant time, so the time taken does not tell how
+// many leading bytes matched.
+inline bool digestEquals(const digest& first, const digest& second) {
+   return CRYPTO_memcmp(first.data(), second.data(), first.size()) == 0;
+}
+
+// Hash a string with unsalted SHA256 as hex, the format passwords were stored in
+// before PBKDF2.
+inline std::string hashString(std::string prompt) {
+   digest hash = sha256(prompt);
+   return toHex(hash.data(), hash.size());
+}
+
+// Derive the PBKDF2-HMAC-SHA256 hash of a password.
+inline digest deriveKey(std::string_view password, const passwordSalt& salt,
+int iterations) {
+   digest hash;
+   PKCS5_PBKDF2_HMAC(password.data(), password.size(), salt.data(),
+   salt.size(), iterations, EVP_sha256(), hash.size(), hash.data());
+   return hash;
+}
+
+// Read a stored PBKDF2 password, returns false if it is in any other format.
+inline bool parseCredential(std::string_view stored, credential& cred) {
+   if (stored.substr(0, KDF_PREFIX.size()) != KDF_PREFIX) return false;
+   stored.remove_prefix(KDF_PREFIX.size());
+
+   // Iterations, up to the next separator.
+   size_t separator = stored.find('$');
+   if (separator == std::string_view::npos || separator == 0 || separator > 9) {
+      return false;
+   }
+   cred.iterations = 0;
+   for (char digit : stored.substr(0, separator)) {
+      if (digit < '0' || digit > '9') return false;
+      cred.iterations = cred.iterations * 10 + (digit - '0');
+   }
+   stored.remove_prefix(separator + 1);
+
+   // Salt and hash, separated by another '$'.
+   if (stored.size() != SALT_SIZE * 2 + 1 + cred.hash.size() * 2
+   || stored[SALT_SIZE * 2] != '$') {
+      return false;
+   }
+   return cred.iterations > 0
+   && fromHex(stored.substr(0, SALT_SIZE * 2), cred.salt.data(), SALT_SIZE)
+   && fromHex(stored.substr(SALT_SIZE * 2 + 1), cred.hash.data(),
+   cred.hash.size());
+}
+
+// Convert a credential to its stored format.
+inline std::string encodeCredential(const credential& cred) {
+   return KDF_PREFIX + std::to_string(cred.iterations) + "$"
+   + toHex(cred.salt.data(), cred.salt.size()) + "$"
+   + toHex(cred.hash.data(), cred.hash.size());
+}
+
+// Hash a new password with a random salt, ready to be stored.
+inline std::string hashPassword(std::string_view password,
+int iterations = passwordIterations) {
+   credential cred;
+   cred.iterations = iterations;
+   RAND_bytes(cred.salt.data(), cred.salt.size());
+   cred.hash = deriveKey(password, cred.salt, iterations);
+   return encodeCredential(cred);
+}
+
+// Check a password against its stored hash, in either the PBKDF2 or the older
+// SHA256 format.
+inline bool verifyPassword(std::string_view password, std::string_view stored) {
+   digest expected;
+   credential cred;
+
+   if (fromHex(stored, expected.data(), expected.size())) {
+      return digestEquals(sha256(password), expected);
+   }
+   if (parseCredential(stored, cred)) {
+      return digestEquals(deriveKey(password, cred.salt, cred.iterations),
+      cred.hash);
+   }
+   return false;
+}
+
+// Whether a stored password should be hashed again, because it is in the older
+// format or uses a different amount of iterations.
+inline bool needsRehash(std::string_view stored) {
+   credential cred;
+   return !parseCredential(stored, cred) || cred.iterations != passwordIterations;
+}
@@ -1,9 +1,30 @@
 #pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <functional>
 #include <iostream>
+#include <list>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <string>
+#include <thread>
 
+#include "arena.hpp"
+#include "connection.hpp"
+#include "credentials.hpp"
 #include "io.hpp"
+#include "locks.hpp"
+#include "metrics.hpp"
+#include "money.hpp"
 #include "sqlite3.h"
 
 // Declare constants for size limits.
@@ -14,92 +35,320 @@ const int MIN_PASS_SIZE = 8;
 const int MAX_PASS_SIZE = 24;
 const int MIN_AGE = 18;
 const int MAX_AGE = 99;
-const int MIN_AMOUNT = 5;
-const int MAX_AMOUNT = 2500;
+const Money MIN_AMOUNT = Money::dollars(5);
+const Money MAX_AMOUNT = Money::dollars(2500);
+const int BATCH_SIZE = 1000;
+const int HISTORY_PAGE_SIZE = 250;
+const int TOP_COUNTERPARTIES = 5;
+const int ARCHIVE_BATCH_SIZE = 25;
+const int64_t DAY_SECONDS = 86400;
+const int BUSY_RETRIES = 50;
+const int BUSY_BACKOFF_US = 100;
+const int MAX_BUSY_BACKOFF_US = 10000;
+
+// How many times a connection set up with waitWhenBusy waits for the write
+// transaction of another connection before giving up.
+const int BUSY_WAITS = 1000;
+
+// The BANK account is always the first account created.
+const int BANK_ID = 1;
+
+// Outcome of a single transfer between two accounts.
+enum class transferStatus {
+   OK, INVALID_AMOUNT, MISSING_ACCOUNT, INSUFFICIENT_FUNDS, FAILED
+};
 
-// Account struct for the account database.
+// Account struct for the account database. The strings come from the given
+// memory resource, so query results can be allocated from a request arena.
+// Copies are made on the heap and may outlive the arena, moves keep the
+// memory they were allocated from.
 struct account {
-   std::string name, pass;
-   int id, age, balance;
+   using allocator_type = std::pmr::polymorphic_allocator<char>;
 
-   account(): id(INVALID_ID), name(""), pass(""), age(-1), balance(-1) {}
+   std::pmr::string name, pass;
+   int id, age;
+   Money balance;
 
-   account(std::string name, std::string pass, int age, int balance) 
-   : id(INVALID_ID), name(name), pass(pass), age(age), balance(balance) {}
+   account(allocator_type alloc = {})
+   : name(alloc), pass(alloc), id(INVALID_ID), age(-1), balance(-1) {}
 
-   account(int id, std::string name, std::string pass, int age, int balance) 
-   : id(id), name(name), pass(pass), age(age), balance(balance) {}
+   account(std::string_view name, std::string_view pass, int age, Money balance,
+   allocator_type alloc = {})
+   : name(name, alloc), pass(pass, alloc), id(INVALID_ID), age(age),
+   balance(balance) {}
 
-   account& operator=(const account& other) {
-      if (this == &other) return *this;
+   account(int id, std::string_view name, std::string_view pass, int age,
+   Money balance, allocator_type alloc = {})
+   : name(name, alloc), pass(pass, alloc), id(id), age(age),
+   balance(balance) {}
 
-      id = other.id;
-      pass = other.pass;
-      name = other.name;
-      age = other.age;
-      balance = other.balance;
+   account(const account&) = default;
+   account(account&&) = default;
+   account& operator=(const account&) = default;
+   account& operator=(account&&) = default;
 
-      return *this;
-   }
+   // Copy or move into the given memory, used by allocator aware containers.
+   account(const account& other, allocator_type alloc)
+   : name(other.name, alloc), pass(other.pass, alloc), id(other.id),
+   age(other.age), balance(other.balance) {}
+
+   account(account&& other, allocator_type alloc)
+   : name(std::move(other.name), alloc), pass(std::move(other.pass), alloc),
+   id(other.id), age(other.age), balance(other.balance) {}
 
    // Convert to formal string.
    std::string string() const {
-      return name + " Id: " + str(id);
+      return std::string(name) + " Id: " + str(id);
+   }
+};
+
+// Hash for looking up interned names by string_view without building a
+// string first.
+struct nameHash {
+   using is_transparent = void;
+
+   size_t operator()(std::string_view name) const {
+      return std::hash<std::string_view>()(name);
    }
 };
 
-// Transactions struct for the transactions database.
+// Keeps one copy of every account name that was read, so transactions can
+// point at names instead of carrying their own strings. Names are never freed,
+// there is one entry per distinct name ever seen. Safe to use from several
+// threads.
+class NameTable {
+public:
+   // Get a view of the interned copy of a name, which lives as long as the
+   // program.
+   std::string_view intern(std::string_view name) {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto found = names.find(name);
+      if (found == names.end()) found = names.emplace(name).first;
+      return *found;
+   }
+
+private:
+   std::unordered_set<std::string, nameHash, std::equal_to<>> names;
+   std::mutex mutex;
+};
+
+inline NameTable nameTable;
+
+// Convert seconds since the epoch to 'YYYY-MM-DD HH:MM:SS' in UTC, the format
+// SQLite stores dates in, or to another strftime format. The buffer needs
+// room for 20 characters.
+inline size_t formatDate(int64_t seconds, char* out, size_t size,
+const char* format = "%Y-%m-%d %H:%M:%S") {
+   time_t time = seconds;
+   struct tm utc;
+   gmtime_r(&time, &utc);
+   return strftime(out, size, format, &utc);
+}
+
+// Get the start and the end of a month in seconds since the epoch, from
+// 'YYYY-MM' or the current month if it is empty. Returns false if the month
+// cannot be read.
+inline bool monthRange(std::string_view month, int64_t& from, int64_t& to) {
+   struct tm start{};
+   if (month.empty()) {
+      time_t now = time(nullptr);
+      gmtime_r(&now, &start);
+   }
+   else if (month.size() != 7 || month[4] != '-'
+   || sscanf(std::string(month).c_str(), "%4d-%2d", &start.tm_year,
+   &start.tm_mon) != 2 || start.tm_mon < 1 || start.tm_mon > 12) {
+      return false;
+   }
+   else {
+      start.tm_year -= 1900;
+      start.tm_mon -= 1;
+   }
+
+   start.tm_mday = 1;
+   start.tm_hour = start.tm_min = start.tm_sec = 0;
+   struct tm end = start;
+   end.tm_mon++;
+   from = timegm(&start);
+   to = timegm(&end);
+   return true;
+}
+
+// Transactions struct for the transactions database. The date is in seconds
+// since the epoch and the names point into the name table, so copying or
+// moving a transaction never allocates.
 struct transaction {
-   std::string date, from, to;
-   int id, fromId, toId, amount;
+   std::string_view from, to;
+   int64_t date;
+   int id, fromId, toId;
+   Money amount;
 
-   transaction(): date(""), id(INVALID_ID), amount(-1), fromId(-1), toId(-1) {}
+   transaction(): date(0), id(INVALID_ID), fromId(-1), toId(-1), amount(-1) {}
 
-   transaction(int amount, int fromId, int toId)
-   : date(""), id(INVALID_ID), amount(amount), fromId(fromId), toId(toId) {}
+   transaction(Money amount, int fromId, int toId)
+   : date(0), id(INVALID_ID), fromId(fromId), toId(toId), amount(amount) {}
 
-   transaction(int id, int fromId, int toId, int amount, std::string date,
-   std::string from, std::string to): date(date), id(id), amount(amount), 
-   fromId(fromId), toId(toId), from(from), to(to) {}
+   transaction(int id, int fromId, int toId, Money amount, int64_t date,
+   std::string_view from, std::string_view to)
+   : from(from), to(to), date(date), id(id), fromId(fromId), toId(toId),
+   amount(amount) {}
 
    // Convert to formal string.
    std::string string() const {
-      return str(amount) + "$ From '" + from + "' To '" + to + "' at " + date;
+      std::string out;
+      appendTo(out);
+      return out;
+   }
+
+   // Append the formal string to out without building temporary strings.
+   void appendTo(std::string& out) const {
+      char time[32];
+      size_t timeLength = formatDate(date, time, sizeof(time));
+      amount.appendTo(out);
+      out.append("$ From '").append(from)
+      .append("' To '").append(to).append("' at ").append(time, timeLength);
    }
 };
 
-// Database class for creating databases.
-class Database {
-public:
-   // Create a new db file and create a new table if they do not exist yet.
-   Database(std::string fileName, std::string sql) {
-      int failed = sqlite3_open(fileName.c_str(), &db);
+// Position in a transaction history, pages continue after the transaction
+// with this date and id. The default starts at the beginning.
+struct historyCursor {
+   int64_t date;
+   int id;
 
-      if (failed) {
-         println(str("Fatal error: Database could not be opened, ") 
-         + sqlite3_errmsg(db), RED);
-         exit(-1);
-      }
+   historyCursor(): date(0), id(0) {}
+};
 
-      // Enable foreign key support for transactions database.
-      sqlite3_exec(db, "PRAGMA foreign_keys = ON;", nullptr, nullptr, nullptr);
+// Which transactions a history read looks at. Transactions moved into the
+// archives are only read with ALL.
+enum class historyScope { HOT, ALL };
 
-      int status = sqlite3_exec(db, sql.c_str(), nullptr, 0, &errorMsg);
-      if (status != SQLITE_OK) {
-         println(str("Fatal Error: Could not create table: ") + errorMsg, RED);
-         sqlite3_free(errorMsg);
-         exit(-2);
-      }
+// Length of the periods a statement is split into.
+enum class reportPeriod { DAY, MONTH };
+
+// Money an account received and sent during a day or a month, which starts at
+// the given seconds since the epoch. Transfers to yourself count as both.
+struct periodTotal {
+   int64_t start, count;
+   Money in, out;
+
+   periodTotal(): start(0), count(0) {}
+
+   periodTotal(int64_t start, Money in, Money out, int64_t count)
+   : start(start), count(count), in(in), out(out) {}
+
+   // Get the money received minus the money sent. Both are never negative, so
+   // the difference always fits.
+   Money net() const {
+      Money total = in;
+      total.subtract(out);
+      return total;
    }
-   
-   // Close the database when the class is deleted to save memory.
-   ~Database() {
-      sqlite3_close(db);
-   };
+
+   // Append the formal string to line, with the date of the period.
+   void appendTo(std::string& line, reportPeriod period) const {
+      char date[32];
+      line.append(date, formatDate(start, date, sizeof(date),
+      (period == reportPeriod::DAY) ? "%Y-%m-%d" : "%Y-%m"));
+      line.append(" in ");
+      in.appendTo(line);
+      line.append("$ out ");
+      out.appendTo(line);
+      line.append("$ net ");
+      net().appendTo(line);
+      line.append("$ (").append(std::to_string(count)).append(")");
+   }
+};
+
+// Money an account received from and sent to one other account. The name
+// points into the name table.
+struct counterparty {
+   std::string_view name;
+   int id;
+   int64_t count;
+   Money in, out;
+
+   counterparty(int id, std::string_view name, Money in, Money out,
+   int64_t count)
+   : name(name), id(id), count(count), in(in), out(out) {}
+
+   // Append the formal string to line.
+   void appendTo(std::string& line) const {
+      line.append("'").append(name).append("' in ");
+      in.appendTo(line);
+      line.append("$ out ");
+      out.appendTo(line);
+      line.append("$ (").append(std::to_string(count)).append(")");
+   }
+};
+
+// Busy handler installed by waitWhenBusy.
+inline int waitForWriter(void*, int attempt) {
+   if (attempt >= BUSY_WAITS) return 0;
+   int shift = std::min(attempt, 10);
+   std::this_thread::sleep_for(std::chrono::microseconds(
+      std::min(BUSY_BACKOFF_US << shift, MAX_BUSY_BACKOFF_US)
+   ));
+   return 1;
+}
+
+// Make statements on the connection wait while another connection is writing,
+// instead of failing with a busy database. The default handler of SQLite
+// sleeps for up to 100ms at a time, far longer than a transfer holds the write
+// lock, so this one backs off from a few microseconds instead.
+inline void waitWhenBusy(Connection& conn) {
+   sqlite3_busy_handler(conn.handle(), waitForWriter, nullptr);
+}
+
+// Base class for the tables, which all share a single connection. Preparing,
+// stepping and committing statements through it is timed in the metrics.
+class Database {
+public:
+   // Use the given shared connection.
+   Database(Connection& conn): conn(conn), db(conn.handle()) {}
 
 protected:
+   Connection& conn;
    sqlite3* db;
-   char* errorMsg;
+
+   // Get the cached prepared statement for the given SQL.
+   sqlite3_stmt* prepare(const std::string& sql) {
+      OperationTimer timer(operation::PREPARE);
+      return conn.prepare(sql);
+   }
+
+   // Step a cached statement once and reset it.
+   int execute(sqlite3_stmt* stmt) {
+      OperationTimer timer(operation::STEP);
+      int status = conn.execute(stmt);
+      if (status != SQLITE_DONE && status != SQLITE_ROW) timer.fail();
+      return status;
+   }
+
+   // Step a statement to its next row without resetting it.
+   int step(sqlite3_stmt* stmt) {
+      OperationTimer timer(operation::STEP);
+      int status = sqlite3_step(stmt);
+      if (status != SQLITE_DONE && status != SQLITE_ROW) timer.fail();
+      return status;
+   }
+
+   // Start a write transaction on the shared connection.
+   bool begin() {
+      return conn.begin();
+   }
+
+   // Commit the current transaction.
+   bool commit() {
+      OperationTimer timer(operation::COMMIT);
+      if (conn.commit()) return true;
+      timer.fail();
+      return false;
+   }
+
+   // Undo everything done in the current transaction.
+   void rollback() {
+      conn.rollback();
+   }
 
    // Handle SQL insertion errors.
    bool handleInsertion(int status, std::string error) {
@@ -110,19 +359,154 @@ protected:
    }
 };
 
+// Default amount of accounts kept in memory.
+const int ACCOUNT_CACHE_SIZE = 100000;
+
+// Which account is thrown out when the cache is full. LRU drops the account
+// that was used the longest time ago, FIFO the one that was loaded first.
+enum class evictionPolicy { LRU, FIFO };
+
+// In-memory cache of accounts keyed by id, with a secondary index by name.
+// Only knows about changes made through this process, other processes writing
+// to the same file are not seen until the account is evicted. Safe to use from
+// several threads.
+class AccountCache {
+public:
+   // Create a cache holding at most the given amount of accounts, a capacity
+   // of zero disables it.
+   AccountCache(int capacity = ACCOUNT_CACHE_SIZE,
+   evictionPolicy policy = evictionPolicy::LRU)
+   : capacity(capacity), policy(policy) {}
+
+   // Get a copy of an account by id allocated from memory, or an invalid
+   // account if it is not cached.
+   account get(int id, std::pmr::memory_resource* memory) {
+      std::lock_guard<std::mutex> lock(mutex);
+      return find(id, memory);
+   }
+
+   // Get a copy of an account by name allocated from memory, or an invalid
+   // account if it is not cached.
+   account getByName(std::string_view name, std::pmr::memory_resource* memory) {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto found = names.find(name);
+      if (found == names.end()) {
+         stats.misses++;
+         return account(memory);
+      }
+      return find(found->second, memory);
+   }
+
+   // Add or replace an account, evicting one if the cache is full.
+   void put(const account& acc) {
+      std::lock_guard<std::mutex> lock(mutex);
+      insert(acc);
+   }
+
+   // Change the cached copy of an account if it is in there, used to write
+   // updates through to the cache. Does not count as a use.
+   void modify(int id, std::function<void(account&)> change) {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto found = ids.find(id);
+      if (found == ids.end()) return;
+
+      account changed = *found->second;
+      change(changed);
+      remove(id);
+      insert(changed);
+   }
+
+   // Remove an account from the cache if it is in there.
+   void erase(int id) {
+      std::lock_guard<std::mutex> lock(mutex);
+      remove(id);
+   }
+
+   // Remove every account.
+   void clear() {
+      std::lock_guard<std::mutex> lock(mutex);
+      entries.clear();
+      ids.clear();
+      names.clear();
+   }
+
+   // Get the hit, miss and eviction counters.
+   cacheStats statistics() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return stats;
+   }
+
+private:
+   int capacity;
+   evictionPolicy policy;
+   cacheStats stats;
+   std::mutex mutex;
+
+   // Most recently added or used account first.
+   std::list<account> entries;
+   std::unordered_map<int, std::list<account>::iterator> ids;
+   std::unordered_map<std::string, int, nameHash, std::equal_to<>> names;
+
+   // Look up an account and mark it as used.
+   account find(int id, std::pmr::memory_resource* memory) {
+      auto found = ids.find(id);
+      if (found == ids.end()) {
+         stats.misses++;
+         return account(memory);
+      }
+
+      stats.hits++;
+      if (policy == evictionPolicy::LRU) {
+         entries.splice(entries.begin(), entries, found->second);
+      }
+      return account(*found->second, memory);
+   }
+
+   // Add an account, evicting the last one if the cache is full.
+   void insert(const account& acc) {
+      if (capacity < 1 || acc.id == INVALID_ID) return;
+      remove(acc.id);
+
+      if (int(entries.size()) >= capacity) {
+         stats.evictions++;
+         remove(entries.back().id);
+      }
+
+      entries.push_front(acc);
+      ids[acc.id] = entries.begin();
+      if (acc.name != "DELETED") {
+         names.insert_or_assign(std::string(acc.name), acc.id);
+      }
+   }
+
+   // Remove an account and its name.
+   void remove(int id) {
+      auto found = ids.find(id);
+      if (found == ids.end()) return;
+
+      auto name = names.find(std::string_view(found->second->name));
+      if (name != names.end() && name->second == id) names.erase(name);
+
+      entries.erase(found->second);
+      ids.erase(found);
+   }
+};
+
 // Account database used to store all of the id's, names, ages and balances
 // of users.
 class Accounts : public Database {
 public:
-   // Create a new database with the file name and an ACCOUNTS table.
-   Accounts() : Database("database/database.db", 
-      "CREATE TABLE IF NOT EXISTS ACCOUNTS("
-      "ID INTEGER PRIMARY KEY AUTOINCREMENT, "
-      "NAME TEXT NOT NULL, "
-      "PASS TEXT NOT NULL, "
-      "AGE INT NOT NULL, "
-      "BALANCE INT NOT NULL);"
-   ) {}
+   // Use the given shared connection, keeping up to cacheSize accounts in
+   // memory.
+   Accounts(Connection& conn, int cacheSize = ACCOUNT_CACHE_SIZE,
+   evictionPolicy policy = evictionPolicy::LRU)
+   : Database(conn), own(cacheSize, policy), cache(own) {}
+
+   // Use the given connection and a cache shared with the accounts tables of
+   // other connections to the same file, so changes made through any of them
+   // are seen by all.
+   Accounts(Connection& conn, AccountCache& shared)
+   : Database(conn), own(0), cache(shared) {}
 
    // Create a new account if the given information is valid and it doesn't
    // exist yet.
@@ -147,23 +531,19 @@ public:
          return false;
       }
 
-      // Create an SQL prepared statement.
-      std::string sql = 
+      // Get the cached SQL prepared statement.
+      sqlite3_stmt* stmt = prepare(
       "INSERT INTO ACCOUNTS "
-      "(NAME,PASS,AGE,BALANCE) VALUES (?,?,?,?);";
-      sqlite3_stmt* stmt;
-      sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0);
+      "(NAME,PASS,AGE,BALANCE) VALUES (?,?,?,?);");
 
       // Bind to the statement.
       sqlite3_bind_text(stmt, 1, acc.name.c_str(), -1, SQLITE_STATIC);
       sqlite3_bind_text(stmt, 2, acc.pass.c_str(), -1, SQLITE_STATIC);
       sqlite3_bind_int(stmt, 3, acc.age);
-      sqlite3_bind_int(stmt, 4, acc.balance);
+      sqlite3_bind_int64(stmt, 4, acc.balance.cents());
 
-      // Execute, close and check for errors.
-      int status = sqlite3_step(stmt);
-      sqlite3_finalize(stmt);
-      return handleInsertion(status, "Could not create an account: ");
+      // Execute, reset and check for errors.
+      return handleInsertion(execute(stmt), "Could not create an account: ");
    }
 
    // Delete the account if it exists.
@@ -178,18 +558,39 @@ public:
       // Force set name to DELETED to show up in transactions and set password
       // to an unhashed string so no one can log into the account.
       updatePass("DELETED", acc.id);
-      return update("NAME = 'DELETED'", acc.id);
+      bool deleted = update("NAME", "DELETED", acc.id);
+      cache.erase(acc.id);
+      return deleted;
    }
 
    // Update user's password.
    bool updatePass(std::string pass, int id) {
-      return update("PASS = '" + pass + "'", id);
+      if (!update("PASS", pass, id)) return false;
+      cache.modify(id, [&](account& acc) { acc.pass = pass; });
+      return true;
+   }
+
+   // Check the password of an account. Passwords stored in an older format are
+   // hashed again with the current settings once they are known to be right.
+   bool authenticate(account& acc, const std::string& password) {
+      OperationTimer timer(operation::LOGIN);
+      if (!verifyPassword(password, acc.pass)) {
+         timer.fail();
+         return false;
+      }
+
+      if (needsRehash(acc.pass)) {
+         std::string pass = hashPassword(password);
+         if (updatePass(pass, acc.id)) acc.pass = pass;
+      }
+      return true;
    }
 
    // Update user's name.
    bool updateName(std::string name, int id) {
-      // Username already exists.
-      if (selectByName(name).id != INVALID_ID) {
+      // Username already exists or it is a reserved one. Deleted accounts
+      // are left out of name lookups, so the reserved name is checked apart.
+      if (selectByName(name).id != INVALID_ID || name == "DELETED") {
          println("Could not rename account to '" + name + "' as an account with "
          "that name already exists, try a different name!", RED);
          return false;
@@ -200,12 +601,16 @@ public:
          println("Username is either too long or too short.", RED);
          return false;
       }
-      return update("NAME = '" + name + "'", id);
+      if (!update("NAME", name, id)) return false;
+      cache.modify(id, [&](account& acc) { acc.name = name; });
+      return true;
    }
 
    // Update user's balance.
-   bool updateBalance(int balance, int id) {
-      return update("BALANCE = " + str(balance), id);
+   bool updateBalance(Money balance, int id) {
+      if (!update("BALANCE", balance, id)) return false;
+      cache.modify(id, [&](account& acc) { acc.balance = balance; });
+      return true;
    }
 
    // Update user's age.
@@ -216,225 +621,1083 @@ public:
          "use our program.", RED);
          return false;
       }
-      return update("AGE = " + str(age), id);
+      if (!update("AGE", age, id)) return false;
+      cache.modify(id, [&](account& acc) { acc.age = age; });
+      return true;
    }
 
-   // Select all of the users.
-   std::vector<account> selectAll() {
-      return selectAccounts("", -1);
+   // Select all of the users. Results are allocated from memory, which is
+   // the heap unless a request arena is given.
+   std::pmr::vector<account> selectAll(
+   std::pmr::memory_resource* memory = std::pmr::get_default_resource()) {
+      return selectAccounts("", -1, memory);
    }
 
    // Select a user with the given name.
-   account selectByName(std::string name) {
-      // Prepare the statement.
-      std::string sql = "SELECT * FROM ACCOUNTS WHERE NAME = ?;";
-      sqlite3_stmt* stmt;
-      sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0);
+   account selectByName(std::string_view name,
+   std::pmr::memory_resource* memory = std::pmr::get_default_resource()) {
+      account cached = cache.getByName(name, memory);
+      if (cached.id != INVALID_ID) return cached;
+
+      // Get the prepared statement. Deleted accounts are left out, which lets
+      // the name index be used.
+      sqlite3_stmt* stmt = prepare(
+      "SELECT * FROM ACCOUNTS WHERE NAME = ? AND NAME <> 'DELETED';");
 
       // Bind the name to the statement and return an account if there is one.
-      sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_STATIC);
-      std::vector<account> accounts = retrieveInfo(stmt);
-      return ((accounts.size() > 0) ? accounts.at(0) : account());
+      sqlite3_bind_text(stmt, 1, name.data(), name.size(), SQLITE_STATIC);
+      std::pmr::vector<account> accounts = retrieveInfo(stmt, memory);
+      if (accounts.size() < 1) return account(memory);
+
+      cache.put(accounts.at(0));
+      return std::move(accounts.at(0));
    }
 
    // Select users by id.
-   std::vector<account> selectById(int id, std::string op = "=") {
-      return selectAccounts("WHERE ID " + op, id);
+   std::pmr::vector<account> selectById(int id, std::string op = "=",
+   std::pmr::memory_resource* memory = std::pmr::get_default_resource()) {
+      if (op != "=") return selectAccounts("WHERE ID " + op, id, memory);
+
+      std::pmr::vector<account> accounts(memory);
+      account cached = cache.get(id, memory);
+      if (cached.id != INVALID_ID) {
+         accounts.push_back(std::move(cached));
+         return accounts;
+      }
+
+      // The query is the same every time, so its text is only built once.
+      static const std::string SELECT_BY_ID =
+      "SELECT * FROM ACCOUNTS WHERE ID = ?;";
+      sqlite3_stmt* stmt = prepare(SELECT_BY_ID);
+      sqlite3_bind_int(stmt, 1, id);
+      accounts = retrieveInfo(stmt, memory);
+      if (accounts.size() > 0) cache.put(accounts.at(0));
+      return accounts;
+   }
+
+   // Drop an account from the cache after it was changed outside of this
+   // class, for example by a transfer.
+   void invalidate(int id) {
+      cache.erase(id);
+   }
+
+   // Get the account cache hit, miss and eviction counters.
+   cacheStats accountCacheStats() {
+      return cache.statistics();
    }
 
 private:
-   // Update given user's property like age, name and such.
-   bool update(std::string type, int id) {
-      // Create an SQL prepared statement.
-      std::string sql = "UPDATE ACCOUNTS SET " + type + " WHERE ID = ?;";
-      sqlite3_stmt* stmt;
-      sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0);
-
-      // Bind id to the statement.
-      sqlite3_bind_int(stmt, 1, id);
+   AccountCache own;
+   AccountCache& cache;
+
+   // Update given user's text property like name or password. The column is
+   // always a constant, so there is one cached statement per column.
+   bool update(std::string column, std::string value, int id) {
+      // Get the cached SQL prepared statement.
+      sqlite3_stmt* stmt = prepare(
+         "UPDATE ACCOUNTS SET " + column + " = ? WHERE ID = ?;"
+      );
+
+      // Bind value and id to the statement.
+      sqlite3_bind_text(stmt, 1, value.c_str(), -1, SQLITE_STATIC);
+      sqlite3_bind_int(stmt, 2, id);
 
       // Finish up and handle errors.
-      int status = sqlite3_step(stmt);
-      sqlite3_finalize(stmt);
-      return handleInsertion(status, "Could not update account: ");
+      return handleInsertion(execute(stmt), "Could not update account: ");
+   }
+
+   // Update given user's numeric property like age.
+   bool update(std::string column, int value, int id) {
+      // Get the cached SQL prepared statement.
+      sqlite3_stmt* stmt = prepare(
+         "UPDATE ACCOUNTS SET " + column + " = ? WHERE ID = ?;"
+      );
+
+      // Bind value and id to the statement.
+      sqlite3_bind_int(stmt, 1, value);
+      sqlite3_bind_int(stmt, 2, id);
+
+      // Finish up and handle errors.
+      return handleInsertion(execute(stmt), "Could not update account: ");
+   }
+
+   // Update given user's amount of money like balance.
+   bool update(std::string column, Money value, int id) {
+      // Get the cached SQL prepared statement.
+      sqlite3_stmt* stmt = prepare(
+         "UPDATE ACCOUNTS SET " + column + " = ? WHERE ID = ?;"
+      );
+
+      // Bind value and id to the statement.
+      sqlite3_bind_int64(stmt, 1, value.cents());
+      sqlite3_bind_int(stmt, 2, id);
+
+      // Finish up and handle errors.
+      return handleInsertion(execute(stmt), "Could not update account: ");
    }
 
    // Select all accounts or accounts by property.
-   std::vector<account> selectAccounts(std::string type, int value) {
-      // Prepare a statement.
+   std::pmr::vector<account> selectAccounts(std::string type, int value,
+   std::pmr::memory_resource* memory) {
+      // Get a prepared statement.
       std::string sql = "SELECT * FROM ACCOUNTS " + type + " ?;";
       if (type.empty()) sql = "SELECT * FROM ACCOUNTS;";
-
-      sqlite3_stmt* stmt;
-      int status = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0);
+      sqlite3_stmt* stmt = prepare(sql);
 
       // Bind to the statement unless everything is selected.
       if (!type.empty()) sqlite3_bind_int(stmt, 1, value);
-      return retrieveInfo(stmt);
+      return retrieveInfo(stmt, memory);
    }
 
-   // Retrieves info from the accounts table based on a statement.
-   std::vector<account> retrieveInfo(sqlite3_stmt* stmt) {
-      std::vector<account> accounts;
+   // Retrieves info from the accounts table based on a statement. The rows
+   // and their strings are allocated from memory.
+   std::pmr::vector<account> retrieveInfo(sqlite3_stmt* stmt,
+   std::pmr::memory_resource* memory) {
+      std::pmr::vector<account> accounts(memory);
 
       // Get all of the users data.
-      while (sqlite3_step(stmt) == SQLITE_ROW) {
+      while (step(stmt) == SQLITE_ROW) {
          // ID, NAME, PASS, AGE, BALANCE
-         int id = sqlite3_column_int(stmt, 0);
-         std::string name = reinterpret_cast<const char*>(
-            sqlite3_column_text(stmt, 1)
+         accounts.emplace_back(
+            sqlite3_column_int(stmt, 0), text(stmt, 1), text(stmt, 2),
+            sqlite3_column_int(stmt, 3), Money(sqlite3_column_int64(stmt, 4))
          );
-         std::string pass = reinterpret_cast<const char*>(
-            sqlite3_column_text(stmt, 2)
-         );
-         int age = sqlite3_column_int(stmt, 3);
-         int balance = sqlite3_column_int(stmt, 4);
-
-         accounts.push_back(account(id, name, pass, age, balance));
       }
 
-      // Finalize and return account list.
-      sqlite3_finalize(stmt);
+      // Reset the cached statement and return account list.
+      sqlite3_reset(stmt);
       return accounts;
    }
+
+   // Get the text of a column without copying it.
+   static std::string_view text(sqlite3_stmt* stmt, int column) {
+      const char* value =
+      reinterpret_cast<const char*>(sqlite3_column_text(stmt, column));
+      return std::string_view(value ? value : "",
+      sqlite3_column_bytes(stmt, column));
+   }
 };
 
-// Transaction database for keeping track of transactions.
-class Transactions : public Database {
+// Where the ledger of transfers is kept. Transfers are appended inside of the
+// write transaction that moves the balances, on the connection running it.
+class LedgerStore {
 public:
-   // Create a new database with the given file name and table TRANSACTIONS if
-   // there are none.
-   Transactions(const Accounts& acc) : Database("database/database.db",
-      "CREATE TABLE IF NOT EXISTS TRANSACTIONS("
-      "ID INTEGER PRIMARY KEY AUTOINCREMENT, "
+   virtual ~LedgerStore() = default;
+
+   // Record a transfer inside of the write transaction of the given connection.
+   virtual bool append(Connection& on, const transaction& trans) = 0;
+
+   // Write the transfers appended on the connection, called inside of its
+   // write transaction right before it commits. A ledger kept outside of
+   // SQLite makes them durable here, so a commit never covers transfers the
+   // ledger does not have.
+   virtual bool flush(Connection&) { return true; }
+
+   // Keep the transfers appended on the connection, called once its write
+   // transaction has committed.
+   virtual bool commit(Connection&) { return true; }
+
+   // Forget the transfers appended on the connection, called once its write
+   // transaction has been rolled back, even after flush.
+   virtual void discard(Connection&) {}
+
+   // Get the latest transaction of a user, or an invalid one.
+   virtual transaction latest(int userId) = 0;
+
+   // Get the next page of transactions of a user, oldest first, and move the
+   // cursor past it, allocated from memory. An empty page means the history is
+   // over.
+   virtual std::pmr::vector<transaction> page(int userId, historyCursor& cursor,
+   int limit, std::pmr::memory_resource* memory) = 0;
+
+   // Call visit for every transaction of a user, oldest first.
+   virtual void forEach(int userId,
+   std::function<void(const transaction&)> visit) = 0;
+};
+
+// Keeps the ledger in the TRANSACTIONS table, next to the accounts.
+class SqliteLedger : public Database, public LedgerStore {
+public:
+   // Use the given shared connection for reading the history, from the
+   // TRANSACTIONS table of the given attached database.
+   SqliteLedger(Connection& conn, const std::string& schema = "main")
+   : Database(conn), history(selectHistory(schema)),
+   pageSql(pageQuery(history)), latestSql(latestQuery(history)) {}
+
+   // Insert the transfer on the connection running the write transaction.
+   bool append(Connection& on, const transaction& trans) override {
+      sqlite3_stmt* stmt = on.prepare(
+      "INSERT INTO TRANSACTIONS (RECEIVER,SENDER,AMOUNT) VALUES(?,?,?);");
+      sqlite3_bind_int(stmt, 1, trans.toId);
+      sqlite3_bind_int(stmt, 2, trans.fromId);
+      sqlite3_bind_int64(stmt, 3, trans.amount.cents());
+      return on.execute(stmt) == SQLITE_DONE;
+   }
+
+   // Orders by date and id descending and gets the latest transaction, the id
+   // breaks ties between transfers made in the same second. The latest sent
+   // and the latest received transaction are each a single seek at the end of
+   // their ledger index, so the history is never read or sorted.
+   transaction latest(int userId) override {
+      sqlite3_stmt* stmt = prepare(latestSql);
+      sqlite3_bind_int(stmt, 1, userId);
+
+      // Finish up and return the later of the two transactions or an invalid
+      // one. The rows fit on the stack.
+      std::byte buffer[4 * sizeof(transaction)];
+      std::pmr::monotonic_buffer_resource memory(buffer, sizeof(buffer));
+      std::pmr::vector<transaction> transactions(&memory);
+      retrieveInfo(stmt, transactions);
+
+      transaction newest;
+      for (const transaction& trans : transactions) {
+         if (newest.id == INVALID_ID || trans.date > newest.date
+         || (trans.date == newest.date && trans.id > newest.id)) {
+            newest = trans;
+         }
+      }
+      return newest;
+   }
+
+   // Each page is read with an index range scan that starts at the cursor, so
+   // it costs the same no matter how long the history is.
+   std::pmr::vector<transaction> page(int userId, historyCursor& cursor,
+   int limit, std::pmr::memory_resource* memory) override {
+      std::pmr::vector<transaction> rows(memory);
+      fetchPage(userId, cursor, limit, rows);
+      return rows;
+   }
+
+   // Only one page is held in memory at a time, and its rows are reused.
+   void forEach(int userId,
+   std::function<void(const transaction&)> visit) override {
+      historyCursor cursor;
+      RequestArena arena(HISTORY_PAGE_SIZE * sizeof(transaction));
+      std::pmr::vector<transaction> rows(arena.resource());
+      rows.reserve(HISTORY_PAGE_SIZE);
+
+      while (true) {
+         rows.clear();
+         fetchPage(userId, cursor, HISTORY_PAGE_SIZE, rows);
+         for (const transaction& trans : rows) visit(trans);
+         if (int(rows.size()) < HISTORY_PAGE_SIZE) return;
+      }
+   }
+
+private:
+   // Queries of the history, built once for the table they read.
+   const std::string history, pageSql, latestSql;
+
+   // Get the latest sent and the latest received transaction. The later one
+   // is picked by the caller, sorting the two rows in SQL would need a
+   // temporary b-tree.
+   static std::string latestQuery(const std::string& history) {
+      return "SELECT * FROM (" + history + "WHERE T.SENDER = ?1 "
+      "ORDER BY T.DATE DESC, T.ID DESC LIMIT 1) "
+      "UNION ALL SELECT * FROM (" + history + "WHERE T.RECEIVER = ?1 "
+      "ORDER BY T.DATE DESC, T.ID DESC LIMIT 1);";
+   }
+
+   // Selects the columns of a history row, resolving the sender and receiver
+   // names with a join instead of looking up every account separately.
+   static std::string selectHistory(const std::string& schema) {
+      return "SELECT T.ID, T.SENDER, T.RECEIVER, T.AMOUNT, "
+      "CAST(strftime('%s', T.DATE) AS INTEGER), S.NAME, R.NAME "
+      "FROM " + schema + ".TRANSACTIONS T "
+      "JOIN main.ACCOUNTS S ON S.ID = T.SENDER "
+      "JOIN main.ACCOUNTS R ON R.ID = T.RECEIVER ";
+   }
+
+   // Read the sent and the received transactions separately, so each side can
+   // walk its own index, and merge them. Transfers to yourself are only read
+   // on the sender side. The rest of the cursor's date and the later dates are
+   // separate seeks, as a single (DATE, ID) range would rescan every
+   // transaction of the cursor's date on each page.
+   static std::string pageQuery(const std::string& history) {
+      std::string sql;
+      for (std::string side : {
+         "T.SENDER = ?1 AND ", "T.RECEIVER = ?1 AND T.SENDER <> ?1 AND "
+      }) {
+         for (std::string range : {
+            "T.DATE = datetime(?2, 'unixepoch') AND T.ID > ?3 ",
+            "T.DATE > datetime(?2, 'unixepoch') "
+         }) {
+            if (!sql.empty()) sql += " UNION ALL ";
+            sql += "SELECT * FROM (" + history + "WHERE " + side + range
+            + "ORDER BY T.DATE, T.ID LIMIT ?4)";
+         }
+      }
+      return sql + " ORDER BY 5, 1 LIMIT ?4;";
+   }
+
+   // Append the page of transactions after the cursor to rows and move the
+   // cursor past it.
+   void fetchPage(int userId, historyCursor& cursor, int limit,
+   std::pmr::vector<transaction>& rows) {
+      sqlite3_stmt* stmt = prepare(pageSql);
+
+      sqlite3_bind_int(stmt, 1, userId);
+      sqlite3_bind_int64(stmt, 2, cursor.date);
+      sqlite3_bind_int(stmt, 3, cursor.id);
+      sqlite3_bind_int(stmt, 4, limit);
+
+      size_t start = rows.size();
+      retrieveInfo(stmt, rows);
+      if (rows.size() > start) {
+         cursor.date = rows.back().date;
+         cursor.id = rows.back().id;
+      }
+   }
+
+   // Append the transactions read by a statement to transactions. Names are
+   // interned, so no row allocates once its names have been seen.
+   void retrieveInfo(sqlite3_stmt* stmt,
+   std::pmr::vector<transaction>& transactions) {
+      // Get all of the transaction data.
+      while (step(stmt) == SQLITE_ROW) {
+         // ID, FROM, TO, AMOUNT, DATE, FROM NAME, TO NAME
+         transactions.emplace_back(
+            sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1),
+            sqlite3_column_int(stmt, 2), Money(sqlite3_column_int64(stmt, 3)),
+            sqlite3_column_int64(stmt, 4), text(stmt, 5), text(stmt, 6)
+         );
+      }
+
+      // Reset the cached statement.
+      sqlite3_reset(stmt);
+   }
+
+   // Get the interned text of a column.
+   static std::string_view text(sqlite3_stmt* stmt, int column) {
+      const char* value =
+      reinterpret_cast<const char*>(sqlite3_column_text(stmt, column));
+      return nameTable.intern(std::string_view(value ? value : "",
+      sqlite3_column_bytes(stmt, column)));
+   }
+};
+
+// Transactions moved out of the TRANSACTIONS table, kept in one file per year
+// next to the database file, like 'database/database-2024.db'. The ARCHIVES
+// table lists the years that have a file. Files are only attached to the
+// connection once they are read or written, SQLite attaches at most 10.
+class Archives : public Database {
+public:
+   // Use the given shared connection.
+   Archives(Connection& conn) : Database(conn) {}
+
+   // Get the years that have an archive, oldest first.
+   std::vector<int> years() {
+      sqlite3_stmt* stmt = prepare("SELECT YEAR FROM ARCHIVES ORDER BY YEAR;");
+      std::vector<int> found;
+      while (step(stmt) == SQLITE_ROW) {
+         found.push_back(sqlite3_column_int(stmt, 0));
+      }
+      sqlite3_reset(stmt);
+      return found;
+   }
+
+   // Get the latest archived transaction of a user, or an invalid one. The
+   // newest years are read first.
+   transaction latest(int userId) {
+      std::vector<int> all = years();
+      for (auto year = all.rbegin(); year != all.rend(); year++) {
+         SqliteLedger* archive = ledger(*year);
+         if (archive == nullptr) {
+            println("Archive " + str(*year) + " is left out.", RED);
+            continue;
+         }
+
+         transaction trans = archive->latest(userId);
+         if (trans.id != INVALID_ID) return trans;
+      }
+      return transaction();
+   }
+
+   // Call visit for every archived transaction of a user, oldest first.
+   void forEach(int userId, std::function<void(const transaction&)> visit) {
+      for (int year : years()) {
+         SqliteLedger* archive = ledger(year);
+         if (archive == nullptr) {
+            println("Archive " + str(year) + " is left out.", RED);
+            continue;
+         }
+         archive->forEach(userId, visit);
+      }
+   }
+
+   // Move the oldest transactions made before the cutoff, in seconds since the
+   // epoch, into the archives of their years. At most limit are moved, and only
+   // those with an id up to last, the checkpoint of the reconciler, so checks
+   // never need an archived row. Returns the amount moved, or -1 on failure.
+   //
+   // The rows are copied into the archives and committed first, then deleted
+   // from the ledger in a short write transaction of their own, so transfers
+   // wait for one delete at most. WAL commits are only atomic per file, a
+   // crash in between leaves the rows in both places until the next batch
+   // copies them again, which changes nothing, and deletes them. So losing a
+   // delete is harmless and it needs no more durability than a transfer.
+   int moveBatch(int64_t cutoff, int last, int limit = ARCHIVE_BATCH_SIZE) {
+      OperationTimer timer(operation::ARCHIVE);
+
+      // Rows are read in id order, old rows that are left come first.
+      sqlite3_stmt* stmt = prepare(
+         "SELECT COALESCE(MIN(ID), 0), COALESCE(MAX(ID), 0), COUNT(*) FROM ("
+         "SELECT ID FROM main.TRANSACTIONS WHERE ID <= ?1 "
+         "AND DATE < datetime(?2, 'unixepoch') ORDER BY ID LIMIT ?3);"
+      );
+      sqlite3_bind_int(stmt, 1, last);
+      sqlite3_bind_int64(stmt, 2, cutoff);
+      sqlite3_bind_int(stmt, 3, limit);
+
+      int first = 0, end = 0, count = 0;
+      if (step(stmt) == SQLITE_ROW) {
+         first = sqlite3_column_int(stmt, 0);
+         end = sqlite3_column_int(stmt, 1);
+         count = sqlite3_column_int(stmt, 2);
+      }
+      sqlite3_reset(stmt);
+      if (count == 0) return 0;
+
+      // Every year in the batch needs a file.
+      std::vector<int> batchYears;
+      stmt = prepare("SELECT DISTINCT CAST(substr(DATE, 1, 4) AS INTEGER) "
+      "FROM main.TRANSACTIONS WHERE " + str(BATCH) + ";");
+      bindBatch(stmt, first, end, cutoff);
+      while (step(stmt) == SQLITE_ROW) {
+         batchYears.push_back(sqlite3_column_int(stmt, 0));
+      }
+      sqlite3_reset(stmt);
+
+      for (int year : batchYears) {
+         if (!create(year)) {
+            timer.fail();
+            return -1;
+         }
+      }
+
+      // Copying only writes to the archives, so transfers can go on meanwhile.
+      // Every year commits on its own, commits are only atomic per file
+      // anyway, and its archive may have to be attached first.
+      for (int year : batchYears) {
+         bool copied = ledger(year) != nullptr
+         && execute(prepare("BEGIN;")) == SQLITE_DONE;
+         if (copied) {
+            stmt = prepare("INSERT OR IGNORE INTO " + schema(year)
+            + ".TRANSACTIONS SELECT ID, SENDER, RECEIVER, AMOUNT, DATE "
+            "FROM main.TRANSACTIONS WHERE " + str(BATCH)
+            + "AND CAST(substr(DATE, 1, 4) AS INTEGER) = ?4;");
+            bindBatch(stmt, first, end, cutoff);
+            sqlite3_bind_int(stmt, 4, year);
+            copied = handleInsertion(execute(stmt), "Could not archive: ")
+            && commit();
+         }
+         if (!copied) {
+            rollback();
+            timer.fail();
+            return -1;
+         }
+      }
+
+      if (!begin()) {
+         timer.fail();
+         return -1;
+      }
+      stmt = prepare("DELETE FROM main.TRANSACTIONS WHERE " + str(BATCH) + ";");
+      bindBatch(stmt, first, end, cutoff);
+      if (!handleInsertion(execute(stmt), "Could not archive: ")) {
+         rollback();
+         timer.fail();
+         return -1;
+      }
+      int moved = sqlite3_changes(db);
+      if (!commit()) {
+         timer.fail();
+         return -1;
+      }
+
+      // A delete touches pages all over the ledger indexes. Copying them back
+      // from the WAL here keeps the commit of some transfer from doing it.
+      sqlite3_wal_checkpoint_v2(db, "main", SQLITE_CHECKPOINT_PASSIVE, nullptr,
+      nullptr);
+      return moved;
+   }
+
+   // Get the file of a year's archive.
+   std::string fileName(int year) {
+      return fileName(sqlite3_db_filename(db, "main"), year);
+   }
+
+   // Get the file of a year's archive of the given database file.
+   static std::string fileName(std::string database, int year) {
+      if (database.ends_with(".db")) database.resize(database.size() - 3);
+      return database + "-" + str(year) + ".db";
+   }
+
+private:
+   std::unordered_map<int, std::unique_ptr<SqliteLedger>> ledgers;
+   std::vector<int> attached;
+   std::unordered_set<int> listed;
+
+   // Limits a batch to the ids in [?1, ?2] made before ?3.
+   static constexpr const char* BATCH =
+   "ID BETWEEN ?1 AND ?2 AND DATE < datetime(?3, 'unixepoch') ";
+
+   // Bind the ids and the cutoff of a batch.
+   static void bindBatch(sqlite3_stmt* stmt, int first, int end,
+   int64_t cutoff) {
+      sqlite3_bind_int(stmt, 1, first);
+      sqlite3_bind_int(stmt, 2, end);
+      sqlite3_bind_int64(stmt, 3, cutoff);
+   }
+
+   // Get the name a year's archive is attached as.
+   static std::string schema(int year) {
+      return "ARCHIVE_" + str(year);
+   }
+
+   // Get the reader of a year's archive, attaching its file if needed. SQLite
+   // only attaches a few files at once, so the archive used the longest ago is
+   // detached first when there is no room. The file gets the same columns and
+   // ledger indexes as the TRANSACTIONS table if it is new. Archives are
+   // always written with synchronous set to FULL, so a batch is on disk before
+   // it is deleted from the ledger. Returns nullptr if it could not be
+   // attached.
+   SqliteLedger* ledger(int year) {
+      auto found = ledgers.find(year);
+      if (found != ledgers.end()) {
+         attached.erase(std::find(attached.begin(), attached.end(), year));
+         attached.push_back(year);
+         return found->second.get();
+      }
+
+      if (int(attached.size()) >= sqlite3_limit(db, SQLITE_LIMIT_ATTACHED, -1)
+      && !detach(attached.front())) {
+         return nullptr;
+      }
+
+      std::string file = fileName(year), name = schema(year);
+      sqlite3_stmt* stmt = prepare("ATTACH DATABASE ?1 AS ?2;");
+      sqlite3_bind_text(stmt, 1, file.c_str(), -1, SQLITE_TRANSIENT);
+      sqlite3_bind_text(stmt, 2, name.c_str(), -1, SQLITE_TRANSIENT);
+      if (execute(stmt) != SQLITE_DONE) {
+         println("Could not attach archive '" + file + "': "
+         + sqlite3_errmsg(db), RED);
+         return nullptr;
+      }
+
+      std::string sql = "PRAGMA " + name + ".journal_mode = WAL;"
+      "PRAGMA " + name + ".synchronous = FULL;"
+      "CREATE TABLE IF NOT EXISTS " + name + ".TRANSACTIONS("
+      "ID INTEGER PRIMARY KEY, "
       "SENDER INTEGER NOT NULL, "
       "RECEIVER INTEGER NOT NULL, "
       "AMOUNT INTEGER NOT NULL, "
-      "DATE DATETIME DEFAULT CURRENT_TIMESTAMP, "
-      "FOREIGN KEY (SENDER) REFERENCES ACCOUNTS(ID), "
-      "FOREIGN KEY (RECEIVER) REFERENCES ACCOUNTS(ID));"
-   ), acc(acc) {}
+      "DATE DATETIME NOT NULL);"
+      "CREATE INDEX IF NOT EXISTS " + name + ".TRANSACTIONS_SENDER "
+      "ON TRANSACTIONS(SENDER, DATE, ID, RECEIVER, AMOUNT);"
+      "CREATE INDEX IF NOT EXISTS " + name + ".TRANSACTIONS_RECEIVER "
+      "ON TRANSACTIONS(RECEIVER, DATE, ID, SENDER, AMOUNT);";
+      if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK) {
+         println("Could not create archive '" + file + "': "
+         + sqlite3_errmsg(db), RED);
+         return nullptr;
+      }
 
-   // Create a new transaction.
-   bool createTransaction(transaction trans) {
-      // One or both users don't exist.
-      if (acc.selectById(trans.fromId).size() < 1 
-      || acc.selectById(trans.toId).size() < 1) {
-         println("One or both of the users does not exist.", RED);
+      attached.push_back(year);
+      return ledgers.emplace(year,
+         std::make_unique<SqliteLedger>(conn, name)
+      ).first->second.get();
+   }
+
+   // Detach a year's archive. Its statements stay cached and are prepared
+   // again by SQLite once it is attached again.
+   bool detach(int year) {
+      sqlite3_stmt* stmt = prepare("DETACH DATABASE ?;");
+      std::string name = schema(year);
+      sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+      if (execute(stmt) != SQLITE_DONE) {
+         println("Could not detach archive '" + fileName(year) + "': "
+         + sqlite3_errmsg(db), RED);
+         return false;
+      }
+
+      ledgers.erase(year);
+      attached.erase(std::find(attached.begin(), attached.end(), year));
+      return true;
+   }
+
+   // Make sure a year has an archive file and is listed, which is only
+   // written once per connection.
+   bool create(int year) {
+      if (listed.contains(year)) return true;
+      if (ledger(year) == nullptr) return false;
+
+      sqlite3_stmt* stmt = prepare(
+         "INSERT OR IGNORE INTO ARCHIVES (YEAR) VALUES(?);"
+      );
+      sqlite3_bind_int(stmt, 1, year);
+      if (!handleInsertion(execute(stmt), "Could not list archive: ")) {
          return false;
       }
+      listed.insert(year);
+      return true;
+   }
+};
+
+// Transaction database for keeping track of transactions.
+class Transactions : public Database {
+public:
+   // Use the given shared connection and accounts table to look up users. The
+   // pool is only needed to submit transfers from several threads. The ledger
+   // is kept in the TRANSACTIONS table unless a different store is given.
+   Transactions(Connection& conn, Accounts& acc, ConnectionPool* pool = nullptr,
+   LedgerStore* store = nullptr)
+   : Database(conn), acc(acc), pool(pool),
+   sqlite(store ? nullptr : std::make_unique<SqliteLedger>(conn)),
+   ledger(store ? *store : *sqlite) {}
+
+   // Create a new transaction.
+   bool createTransaction(transaction trans) {
+      OperationTimer timer(operation::TRANSFER);
 
       // Amount sent is not sufficient.
       if (trans.amount < MIN_AMOUNT) {
          println("Cannot send less than " + str(MIN_AMOUNT) + "$.", RED);
+         timer.fail();
          return false;
       }
 
       // Amount sent is too large.
       if (trans.amount > MAX_AMOUNT) {
          println("Cannot send more than " + str(MAX_AMOUNT) + "$.", RED);
+         timer.fail();
          return false;
       }
 
-      // Manage money accordingly.
-      account sender = acc.selectById(trans.fromId).at(0);
-      account receiver = acc.selectById(trans.toId).at(0);
+      // Run the whole transfer inside of a single write transaction, so it is
+      // atomic and only pays for one commit.
+      if (!begin()) {
+         timer.fail();
+         return false;
+      }
 
-      acc.updateBalance(sender.balance - trans.amount, sender.id);
-      acc.updateBalance(receiver.balance + trans.amount, receiver.id);
+      switch (transfer(conn, trans)) {
+      case transferStatus::OK:
+         if (!ledger.flush(conn) || !commit()) break;
+         acc.invalidate(trans.fromId);
+         acc.invalidate(trans.toId);
+         if (record(conn)) return true;
+         timer.fail();
+         return false;
+      case transferStatus::MISSING_ACCOUNT:
+         println("One or both of the users does not exist.", RED);
+         break;
+      case transferStatus::INSUFFICIENT_FUNDS:
+         println("Sender does not have enough money to send " 
+         + str(trans.amount) + "$.", RED);
+         break;
+      default:
+         println(str("Could not create transaction: ") + sqlite3_errmsg(db), RED);
+         break;
+      }
 
-      // Create SQL prepared statement.
-      std::string sql = "INSERT INTO TRANSACTIONS (RECEIVER,SENDER,AMOUNT) "
-      "VALUES(?,?,?);";
-      sqlite3_stmt* stmt;
-      sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0);
+      undo(conn);
+      timer.fail();
+      return false;
+   }
 
-      // Bind to the statement.
-      sqlite3_bind_int(stmt, 1, trans.toId);
-      sqlite3_bind_int(stmt, 2, trans.fromId);
-      sqlite3_bind_int(stmt, 3, trans.amount);
+   // Create many transactions at once, committing them in chunks of the given
+   // size instead of once per transfer. Transfers with an amount outside of the
+   // limits are skipped. Returns the status of every transfer in the batch.
+   std::vector<transferStatus> createTransactions(
+   std::span<const transaction> batch, int chunkSize = BATCH_SIZE) {
+      std::vector<transferStatus> statuses(batch.size());
+      if (chunkSize < 1) chunkSize = batch.size();
+
+      // Validate the whole batch before touching the database.
+      for (size_t i = 0; i < batch.size(); i++) {
+         statuses[i] = (batch[i].amount < MIN_AMOUNT 
+         || batch[i].amount > MAX_AMOUNT)
+         ? transferStatus::INVALID_AMOUNT
+         : transferStatus::OK;
+      }
 
-      // Finalize and check for errors.
-      int status = sqlite3_step(stmt);
-      sqlite3_finalize(stmt);
-      return handleInsertion(status, "Could not create transaction.");
+      for (size_t start = 0; start < batch.size(); start += chunkSize) {
+         size_t end = std::min(batch.size(), start + chunkSize);
+         bool failed = !begin();
+
+         // Apply every valid transfer of the chunk in the same transaction.
+         for (size_t i = start; i < end && !failed; i++) {
+            if (statuses[i] != transferStatus::OK) continue;
+            statuses[i] = transfer(conn, batch[i]);
+            failed = statuses[i] == transferStatus::FAILED;
+         }
+
+         if (!failed && ledger.flush(conn) && commit()) {
+            // Balances changed, so the cached accounts are out of date.
+            for (size_t i = start; i < end; i++) {
+               if (statuses[i] != transferStatus::OK) continue;
+               acc.invalidate(batch[i].fromId);
+               acc.invalidate(batch[i].toId);
+            }
+            record(conn);
+            continue;
+         }
+
+         // A statement or the commit failed, so the whole chunk is undone.
+         undo(conn);
+         for (size_t i = start; i < end; i++) {
+            if (statuses[i] == transferStatus::OK) {
+               statuses[i] = transferStatus::FAILED;
+            }
+         }
+      }
+
+      return statuses;
+   }
+
+   // Create a transaction from any thread, on a connection of the pool. The
+   // two accounts are locked in a fixed order and a busy database is retried
+   // with an exponential backoff. Nothing is printed, the status tells what
+   // happened.
+   transferStatus submitTransaction(const transaction& trans) {
+      OperationTimer timer(operation::TRANSFER);
+      transferStatus status = submit(trans);
+      if (status != transferStatus::OK) timer.fail();
+      return status;
    }
 
    // Get the latest transaction where the given user has either received money
-   // or sent money to someone else.
-   transaction getLatestTransaction(int userId) {
+   // or sent money to someone else. Lookups are allocated from memory. The
+   // archives are only read with ALL and if the ledger has nothing.
+   transaction getLatestTransaction(int userId,
+   std::pmr::memory_resource* memory = std::pmr::get_default_resource(),
+   historyScope scope = historyScope::HOT) {
+      OperationTimer timer(operation::HISTORY);
+
       // User does not exist.
-      if (acc.selectById(userId).size() < 1) {
+      if (acc.selectById(userId, "=", memory).size() < 1) {
          println("Account does not exist.", RED);
+         timer.fail();
       }
 
-      // Create SQL prepared statement. Orders by date descending and gets the
-      // latest transaction.
-      std::string sql = 
-      "SELECT * FROM TRANSACTIONS WHERE RECEIVER = ? OR SENDER = ? "
-      "ORDER BY DATE DESC LIMIT 1;";
-      sqlite3_stmt* stmt;
-      sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0);
-
-      // Bind id to both values of the statement.
-      sqlite3_bind_int(stmt, 1, userId);
-      sqlite3_bind_int(stmt, 2, userId);
-
-      // Finish up and return the first transaction or an invalid one.
-      std::vector<transaction> transactions = retrieveInfo(stmt);
-      return ((transactions.size() > 0) ? transactions.at(0) : transaction());
+      transaction latest = ledger.latest(userId);
+      if (latest.id == INVALID_ID && scope == historyScope::ALL && sqlite) {
+         latest = archived().latest(userId);
+      }
+      return latest;
    }
 
-   // Get all of the transactions by a specific user.
-   std::vector<transaction> getTransactions(int userId) {
+   // Get all of the transactions by a specific user, allocated from memory.
+   // With ALL the archived transactions come first.
+   std::pmr::vector<transaction> getTransactions(int userId,
+   std::pmr::memory_resource* memory = std::pmr::get_default_resource(),
+   historyScope scope = historyScope::HOT) {
+      OperationTimer timer(operation::HISTORY);
+
       // User does not exist.
-      if (acc.selectById(userId).size() < 1) {
+      if (acc.selectById(userId, "=", memory).size() < 1) {
          println("Account does not exist.", RED);
+         timer.fail();
+      }
+
+      std::pmr::vector<transaction> transactions(memory);
+      auto add = [&](const transaction& trans) {
+         transactions.push_back(trans);
+      };
+      if (scope == historyScope::ALL && sqlite) archived().forEach(userId, add);
+      ledger.forEach(userId, add);
+      return transactions;
+   }
+
+   // Get the next page of transactions by a specific user, ordered by date and
+   // id, and move the cursor past it. An empty page means the history is over.
+   std::pmr::vector<transaction> getTransactionsPage(int userId,
+   historyCursor& cursor, int limit = HISTORY_PAGE_SIZE,
+   std::pmr::memory_resource* memory = std::pmr::get_default_resource()) {
+      OperationTimer timer(operation::HISTORY);
+      return ledger.page(userId, cursor, limit, memory);
+   }
+
+   // Call visit for every transaction by a specific user, oldest first,
+   // without holding the whole history in memory. With ALL the archived
+   // transactions come first.
+   void forEachTransaction(int userId,
+   std::function<void(const transaction&)> visit,
+   historyScope scope = historyScope::HOT) {
+      OperationTimer timer(operation::HISTORY);
+      if (scope == historyScope::ALL && sqlite) {
+         archived().forEach(userId, visit);
       }
+      ledger.forEach(userId, visit);
+   }
 
-      // Create SQL prepared statement.
-      std::string sql = 
-      "SELECT * FROM TRANSACTIONS WHERE RECEIVER = ? OR SENDER = ? "
-      "ORDER BY DATE ASC;";
-      sqlite3_stmt* stmt;
-      sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, 0);
-      
-      // Bind both of the values to the user id.
+   // Check whether any transactions were archived. Always false if the ledger
+   // is not kept in the TRANSACTIONS table.
+   bool hasArchives() {
+      return sqlite && !archived().years().empty();
+   }
+
+   // Get the money a user received and sent on every day or month that had
+   // transactions, between from and to in seconds since the epoch, oldest
+   // first. Reports are added up by SQLite from the TRANSACTIONS table, only
+   // the totals are read. Archived transactions are left out.
+   std::pmr::vector<periodTotal> getSummary(int userId, int64_t from,
+   int64_t to, reportPeriod period = reportPeriod::MONTH,
+   std::pmr::memory_resource* memory = std::pmr::get_default_resource()) {
+      OperationTimer timer(operation::REPORT);
+
+      // Each side walks the range of its ledger index, which covers every
+      // column read. Transfers to yourself are only read on the sender side.
+      sqlite3_stmt* stmt = prepare(
+         "SELECT " + str(PERIOD_START)
+         + ", SUM(INFLOW), SUM(OUTFLOW), COUNT(*) "
+         "FROM (SELECT substr(DATE, 1, ?4) AS PERIOD, "
+         "CASE WHEN RECEIVER = ?1 THEN AMOUNT ELSE 0 END AS INFLOW, "
+         "AMOUNT AS OUTFLOW FROM TRANSACTIONS WHERE SENDER = ?1 AND "
+         + str(RANGE)
+         + "UNION ALL SELECT substr(DATE, 1, ?4), AMOUNT, 0 FROM TRANSACTIONS "
+         "WHERE RECEIVER = ?1 AND SENDER <> ?1 AND " + str(RANGE)
+         + ") GROUP BY PERIOD ORDER BY PERIOD;"
+      );
+      bindRange(stmt, from, to, period);
       sqlite3_bind_int(stmt, 1, userId);
-      sqlite3_bind_int(stmt, 2, userId);
 
-      // Return all of the transactions by user.
-      return retrieveInfo(stmt);
+      std::pmr::vector<periodTotal> totals(memory);
+      while (step(stmt) == SQLITE_ROW) {
+         totals.emplace_back(sqlite3_column_int64(stmt, 0),
+            Money(sqlite3_column_int64(stmt, 1)),
+            Money(sqlite3_column_int64(stmt, 2)), sqlite3_column_int64(stmt, 3)
+         );
+      }
+      if (sqlite3_reset(stmt) != SQLITE_OK) timer.fail();
+      return totals;
+   }
+
+   // Get the accounts a user moved the most money with between from and to,
+   // at most limit of them, most money first.
+   std::pmr::vector<counterparty> getCounterparties(int userId, int64_t from,
+   int64_t to, int limit = TOP_COUNTERPARTIES,
+   std::pmr::memory_resource* memory = std::pmr::get_default_resource()) {
+      OperationTimer timer(operation::REPORT);
+
+      // Transfers to yourself are only read on the sender side, like in
+      // getSummary, so they are counted once.
+      sqlite3_stmt* stmt = prepare(
+         "SELECT P.PARTY, A.NAME, SUM(P.INFLOW), SUM(P.OUTFLOW), COUNT(*) FROM ("
+         "SELECT RECEIVER AS PARTY, CASE WHEN RECEIVER = ?1 THEN AMOUNT ELSE 0 "
+         "END AS INFLOW, AMOUNT AS OUTFLOW "
+         "FROM TRANSACTIONS WHERE SENDER = ?1 AND " + str(RANGE)
+         + "UNION ALL SELECT SENDER, AMOUNT, 0 FROM TRANSACTIONS "
+         "WHERE RECEIVER = ?1 AND SENDER <> ?1 AND " + str(RANGE)
+         + ") P JOIN ACCOUNTS A ON A.ID = P.PARTY GROUP BY P.PARTY "
+         "ORDER BY SUM(P.INFLOW) + SUM(P.OUTFLOW) DESC, P.PARTY LIMIT ?4;"
+      );
+      sqlite3_bind_int(stmt, 1, userId);
+      sqlite3_bind_int64(stmt, 2, from);
+      sqlite3_bind_int64(stmt, 3, to);
+      sqlite3_bind_int(stmt, 4, limit);
+
+      std::pmr::vector<counterparty> parties(memory);
+      while (step(stmt) == SQLITE_ROW) {
+         const char* name =
+         reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+         parties.emplace_back(sqlite3_column_int(stmt, 0),
+            nameTable.intern(std::string_view(name ? name : "",
+            sqlite3_column_bytes(stmt, 1))),
+            Money(sqlite3_column_int64(stmt, 2)),
+            Money(sqlite3_column_int64(stmt, 3)), sqlite3_column_int64(stmt, 4)
+         );
+      }
+      if (sqlite3_reset(stmt) != SQLITE_OK) timer.fail();
+      return parties;
+   }
+
+   // Call visit with the totals of every account for every day or month
+   // between from and to, ordered by account and then by period. A single
+   // query reads the ledger once for the senders and once for the receivers,
+   // and nothing but the totals is held in memory.
+   void forEachStatement(int64_t from, int64_t to, reportPeriod period,
+   std::function<void(int, const periodTotal&)> visit) {
+      OperationTimer timer(operation::REPORT);
+
+      // Each side is added up on its own ledger index first, so the final
+      // GROUP BY only merges two sorted lists of totals instead of sorting
+      // every transfer twice.
+      sqlite3_stmt* stmt = prepare(
+         "SELECT ACCOUNT, " + str(PERIOD_START) + ", SUM(INFLOW), SUM(OUTFLOW), "
+         "SUM(COUNTED) FROM (SELECT SENDER AS ACCOUNT, substr(DATE, 1, ?4) "
+         "AS PERIOD, 0 AS INFLOW, SUM(AMOUNT) AS OUTFLOW, COUNT(*) AS COUNTED "
+         "FROM TRANSACTIONS WHERE " + str(RANGE) + "GROUP BY SENDER, PERIOD "
+         "UNION ALL SELECT RECEIVER, substr(DATE, 1, ?4), SUM(AMOUNT), 0, "
+         "SUM(SENDER <> RECEIVER) FROM TRANSACTIONS WHERE " + str(RANGE)
+         + "GROUP BY RECEIVER, 2 ORDER BY 1, 2) GROUP BY ACCOUNT, PERIOD "
+         "ORDER BY ACCOUNT, PERIOD;"
+      );
+      bindRange(stmt, from, to, period);
+
+      while (step(stmt) == SQLITE_ROW) {
+         visit(sqlite3_column_int(stmt, 0), periodTotal(
+            sqlite3_column_int64(stmt, 1), Money(sqlite3_column_int64(stmt, 2)),
+            Money(sqlite3_column_int64(stmt, 3)), sqlite3_column_int64(stmt, 4)
+         ));
+      }
+      if (sqlite3_reset(stmt) != SQLITE_OK) timer.fail();
    }
 
 private:
-   Accounts acc;
+   // Limits the dates of a report to [?2, ?3) in seconds since the epoch.
+   static constexpr const char* RANGE =
+   "DATE >= datetime(?2, 'unixepoch') AND DATE < datetime(?3, 'unixepoch') ";
+
+   // Turns the PERIOD of a report, the first ?4 characters of its dates, into
+   // seconds since the epoch. Rows are grouped by the text so the date is only
+   // parsed once per period instead of once per row.
+   static constexpr const char* PERIOD_START =
+   "CAST(strftime('%s', substr(PERIOD || '-01', 1, 10)) AS INTEGER)";
+
+   // Bind the date range and the period of a report. Dates look like
+   // 'YYYY-MM-DD HH:MM:SS', a day is the first 10 characters and a month the
+   // first 7.
+   static void bindRange(sqlite3_stmt* stmt, int64_t from, int64_t to,
+   reportPeriod period) {
+      sqlite3_bind_int64(stmt, 2, from);
+      sqlite3_bind_int64(stmt, 3, to);
+      sqlite3_bind_int(stmt, 4, (period == reportPeriod::DAY) ? 10 : 7);
+   }
 
-   // Retrieves info from transactions based on statement.
-   std::vector<transaction> retrieveInfo(sqlite3_stmt* stmt) {
-      std::vector<transaction> transactions;
+   Accounts& acc;
+   ConnectionPool* pool;
+   LockManager locks;
+   std::unique_ptr<SqliteLedger> sqlite;
+   LedgerStore& ledger;
+   std::unique_ptr<Archives> archives;
+
+   // Get the archives of the TRANSACTIONS table, opened the first time they
+   // are read.
+   Archives& archived() {
+      if (!archives) archives = std::make_unique<Archives>(conn);
+      return *archives;
+   }
 
-      // Get all of the transaction data.
+   // Keep the transfers of a committed write transaction in the ledger. They
+   // were written by flush before the commit, so the balances and the
+   // ledger stay in step.
+   bool record(Connection& on) {
+      if (ledger.commit(on)) return true;
+      println("Could not record the transaction in the ledger.", RED);
+      return false;
+   }
+
+   // Send a transfer on a connection of the pool, see submitTransaction.
+   transferStatus submit(const transaction& trans) {
+      if (trans.amount < MIN_AMOUNT || trans.amount > MAX_AMOUNT) {
+         return transferStatus::INVALID_AMOUNT;
+      }
+      if (pool == nullptr) return transferStatus::FAILED;
+
+      ConnectionPool::Lease lease = pool->acquire();
+      int backoff = BUSY_BACKOFF_US;
+
+      for (int attempt = 0; attempt < BUSY_RETRIES; attempt++) {
+         // The stripes are only locked for one attempt, so transfers on the
+         // same accounts do not wait for this one to back off.
+         {
+            pairLock locks = this->locks.lockPair(trans.fromId, trans.toId);
+            int status = lease->execute(lease->prepare("BEGIN IMMEDIATE;"));
+
+            if (status == SQLITE_DONE) {
+               transferStatus result = transfer(*lease, trans);
+               if (result != transferStatus::OK) {
+                  undo(*lease);
+                  return result;
+               }
+
+               if (!ledger.flush(*lease)) {
+                  undo(*lease);
+                  return transferStatus::FAILED;
+               }
+               status = lease->execute(lease->prepare("COMMIT;"));
+               if (status == SQLITE_DONE) {
+                  acc.invalidate(trans.fromId);
+                  acc.invalidate(trans.toId);
+                  if (!ledger.commit(*lease)) return transferStatus::FAILED;
+                  return transferStatus::OK;
+               }
+               undo(*lease);
+            }
+            if (status != SQLITE_BUSY) return transferStatus::FAILED;
+         }
+
+         // Another connection is writing, wait a bit and try again.
+         std::this_thread::sleep_for(std::chrono::microseconds(backoff));
+         backoff = std::min(backoff * 2, MAX_BUSY_BACKOFF_US);
+      }
+
+      return transferStatus::FAILED;
+   }
+
+   // Roll back a write transaction along with the transfers it appended to
+   // the ledger.
+   void undo(Connection& on) {
+      on.rollback();
+      ledger.discard(on);
+   }
+
+   // Move money between two accounts and record it in the ledger on the given
+   // connection. Must be run inside of a write transaction, which keeps the
+   // checks and the updates from racing with other writers.
+   transferStatus transfer(Connection& on, const transaction& trans) {
+      // Check that both users exist and read their balances.
+      sqlite3_stmt* stmt = on.prepare(
+      "SELECT ID, BALANCE FROM ACCOUNTS WHERE ID IN (?,?);");
+      sqlite3_bind_int(stmt, 1, trans.fromId);
+      sqlite3_bind_int(stmt, 2, trans.toId);
+
+      bool senderFound = false, receiverFound = false;
+      Money sent, received;
       while (sqlite3_step(stmt) == SQLITE_ROW) {
-         // ID, FROM, TO, AMOUNT, DATE
          int id = sqlite3_column_int(stmt, 0);
-         int from = sqlite3_column_int(stmt, 1);
-         int to = sqlite3_column_int(stmt, 2);
-         int amount = sqlite3_column_int(stmt, 3);
-         std::string date = reinterpret_cast<const char*> (
-            sqlite3_column_text(stmt, 4)
-         );
+         Money balance(sqlite3_column_int64(stmt, 1));
+         if (id == trans.fromId) {
+            senderFound = true;
+            sent = balance;
+         }
+         if (id == trans.toId) {
+            receiverFound = true;
+            received = balance;
+         }
+      }
+      sqlite3_reset(stmt);
 
-         account sender = acc.selectById(from).at(0);
-         account receiver = acc.selectById(to).at(0);
+      if (!senderFound || !receiverFound) return transferStatus::MISSING_ACCOUNT;
 
-         transactions.push_back(transaction(
-            id, from, to, amount, date, sender.name, receiver.name
-         ));
+      // The bank is the source of all deposits, so it is allowed to go negative.
+      if (trans.fromId != BANK_ID && sent < trans.amount) {
+         return transferStatus::INSUFFICIENT_FUNDS;
       }
 
-      // Finalize and return transaction list.
-      sqlite3_finalize(stmt);
-      return transactions;
+      // SQLite would turn a balance that does not fit into a float.
+      if (!sent.subtract(trans.amount) || !received.add(trans.amount)) {
+         return transferStatus::FAILED;
+      }
+
+      // Debit and credit relative to the current balances.
+      stmt = on.prepare(
+      "UPDATE ACCOUNTS SET BALANCE = BALANCE - ? WHERE ID = ?;");
+      sqlite3_bind_int64(stmt, 1, trans.amount.cents());
+      sqlite3_bind_int(stmt, 2, trans.fromId);
+      if (on.execute(stmt) != SQLITE_DONE) return transferStatus::FAILED;
+
+      stmt = on.prepare(
+      "UPDATE ACCOUNTS SET BALANCE = BALANCE + ? WHERE ID = ?;");
+      sqlite3_bind_int64(stmt, 1, trans.amount.cents());
+      sqlite3_bind_int(stmt, 2, trans.toId);
+      if (on.execute(stmt) != SQLITE_DONE) return transferStatus::FAILED;
+
+      // Record the transfer in the ledger.
+      if (!ledger.append(on, trans)) return transferStatus::FAILED;
+
+      return transferStatus::OK;
    }
 };
\ No newline at end of file
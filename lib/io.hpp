@@ -1,12 +1,13 @@
 #pragma once
-#include <openssl/sha.h>
 #include <termios.h>
 #include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
 #include <limits>
-#include <iomanip>
+#include <mutex>
 #include <iostream>
-#include <sstream>
 #include <string>
+#include <string_view>
 
 // Convert integer to string.
 inline std::string str(int number) {
@@ -18,17 +19,20 @@ inline std::string str(std::string prompt) {
    return prompt;
 }
 
-// Used for terminal ANSI escape codes.
+// Used for terminal ANSI escape codes. The escape sequence is built once, so
+// printing in color does not allocate.
 struct rgb {
    int r, g, b;
+   std::string code;
 
-   rgb(): r(0), g(0), b(0) {}
-   rgb(int size): r(size), g(size), b(size) {}
-   rgb(int r, int g, int b): r(r), g(g), b(b) {}
+   rgb(): rgb(0, 0, 0) {}
+   rgb(int size): rgb(size, size, size) {}
+   rgb(int r, int g, int b): r(r), g(g), b(b),
+   code("\033[38;2;" + str(r) + ";" + str(g) + ";" + str(b) + "m") {}
 
    // Convert to string.
    operator std::string() const {
-      return "\033[38;2;" + str(r) + ";" + str(g) + ";" + str(b) + "m";
+      return code;
    }
 };
 
@@ -39,58 +43,156 @@ const rgb GREEN(126, 232, 51);
 const rgb BLUE(58, 122, 224);
 const std::string RES = "\033[0m";
 
-// Print to terminal.
-inline void print() {
-   std::cout << "";
+// Whether colored prints use ANSI escape codes, turned off when the output is
+// not read by a person.
+inline bool useColors = isatty(STDOUT_FILENO);
+
+// Where the prints of the current thread are collected instead, while it is
+// running a command whose output goes somewhere else, see capturedPrints.
+inline thread_local std::string* captured = nullptr;
+
+// Size the output buffer is written out at.
+const size_t OUTPUT_BUFFER_SIZE = 1 << 16;
+
+// Collects everything printed and writes it to stdout in large chunks. It is
+// written out before reading input and when the program exits.
+class OutputBuffer {
+public:
+   OutputBuffer() {
+      buffer.reserve(OUTPUT_BUFFER_SIZE);
+   }
+
+   ~OutputBuffer() {
+      flush();
+   }
+
+   // Add text, and a color around it if colors are on. Collected prints get
+   // no colors, and a printed line starts a line of its own.
+   void write(std::string_view text, const rgb* color = nullptr,
+   bool newline = false) {
+      if (captured) {
+         if (newline && !captured->empty() && captured->back() != '\n') {
+            *captured += '\n';
+         }
+         *captured += text;
+         return;
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      bool colored = color && useColors;
+
+      if (colored) buffer += color->code;
+      buffer += text;
+      if (newline) buffer += '\n';
+      if (colored) buffer += RES;
+
+      if (buffer.size() >= OUTPUT_BUFFER_SIZE) writeOut();
+   }
+
+   // Write everything collected so far to stdout.
+   void flush() {
+      std::lock_guard<std::mutex> lock(mutex);
+      writeOut();
+   }
+
+private:
+   std::string buffer;
+   std::mutex mutex;
+
+   // Write the buffer, retrying partial writes. Expects the mutex to be held.
+   void writeOut() {
+      size_t written = 0;
+      while (written < buffer.size()) {
+         ssize_t count = ::write(STDOUT_FILENO, buffer.data() + written,
+         buffer.size() - written);
+         if (count < 0 && errno == EINTR) continue;
+         if (count <= 0) break;
+         written += count;
+      }
+      buffer.clear();
+   }
+};
+
+inline OutputBuffer output;
+
+// Write everything printed so far to the terminal.
+inline void flush() {
+   output.flush();
 }
 
-inline void print(std::string prompt) {
-   std::cout << prompt;
+// Collects the prints of the current thread into a string while it lives.
+struct capturedPrints {
+   std::string* previous;
+
+   capturedPrints(std::string& into) : previous(captured) {
+      captured = &into;
+   }
+
+   ~capturedPrints() {
+      captured = previous;
+   }
+};
+
+// Print to terminal.
+inline void print() {}
+
+inline void print(std::string_view prompt) {
+   output.write(prompt);
 }
 
-inline void print(std::string prompt, std::string color) {
-   std::cout << color << prompt << RES;
+inline void print(std::string_view prompt, const rgb& color) {
+   output.write(prompt, &color);
 }
 
 inline void print(char prompt) {
-   std::cout << prompt;
+   output.write(std::string_view(&prompt, 1));
 }
 
-inline void print(char prompt, std::string color) {
-   std::cout << color << prompt << RES;
+inline void print(char prompt, const rgb& color) {
+   output.write(std::string_view(&prompt, 1), &color);
 }
 
 // Print to terminal with a newline character at the end.
 inline void println() {
-   std::cout << "\n";
+   output.write("\n");
 }
 
-inline void println(std::string prompt) {
-   std::cout << prompt << "\n";
+inline void println(std::string_view prompt) {
+   output.write(prompt, nullptr, true);
 }
 
-inline void println(std::string prompt, std::string color) {
-   std::cout << color << prompt << "\n" << RES;
+inline void println(std::string_view prompt, const rgb& color) {
+   output.write(prompt, &color, true);
 }
 
 inline void println(char prompt) {
-   std::cout << prompt << "\n";
+   output.write(std::string_view(&prompt, 1), nullptr, true);
+}
+
+inline void println(char prompt, const rgb& color) {
+   output.write(std::string_view(&prompt, 1), &color, true);
 }
 
-inline void println(char prompt, std::string color) {
-   std::cout << color << prompt << "\n" << RES;
+// Print an error that ends the program and exit with the code. It always goes
+// to the terminal, even while the thread's prints are collected.
+[[noreturn]] inline void fatal(std::string_view message, int code) {
+   captured = nullptr;
+   println(message, RED);
+   exit(code);
 }
 
 // Get string input from the user.
 inline std::string getInput(std::string prompt) {
    print(prompt);
+   flush();
    std::string input;
    std::getline(std::cin, input);
    return input;
 }
 
-inline std::string getInput(std::string prompt, std::string color) {
+inline std::string getInput(std::string prompt, const rgb& color) {
    print(prompt, color);
+   flush();
    std::string input;
    std::getline(std::cin, input);
    return input;
@@ -98,25 +200,29 @@ inline std::string getInput(std::string prompt, std::string color) {
 
 inline int getNumber(std::string prompt) {
    print(prompt);
+   flush();
    int number;
 
    while (!(std::cin >> number)) {
       std::cin.clear();
       std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
       print("Invalid input. Please try again > ", RED);
+      flush();
    }
    getInput("");
    return number;
 }
 
-inline int getNumber(std::string prompt, std::string color) {
+inline int getNumber(std::string prompt, const rgb& color) {
    print(prompt, color);
+   flush();
    int number;
 
    while (!(std::cin >> number)) {
       std::cin.clear();
       std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
       print("Invalid input. Please try again > ", RED);
+      flush();
    }
    getInput("");
    return number;
@@ -144,6 +250,7 @@ inline void resetTerminal() {
 // Get a string while hiding what's typed by the user.
 inline std::string getHiddenInput(std::string prompt) {
    print(prompt);
+   flush();
 
    setRawMode();
    std::string input;
@@ -154,8 +261,9 @@ inline std::string getHiddenInput(std::string prompt) {
    return input;
 }
 
-inline std::string getHiddenInput(std::string prompt, std::string color) {
+inline std::string getHiddenInput(std::string prompt, const rgb& color) {
    print(prompt, color);
+   flush();
 
    setRawMode();
    std::string input;
@@ -169,6 +277,7 @@ inline std::string getHiddenInput(std::string prompt, std::string color) {
 // Get a character input from the user.
 inline char getKey(std::string prompt) {
    print(prompt);
+   flush();
    setRawMode();
 
    char key = std::tolower(getchar());
@@ -177,8 +286,9 @@ inline char getKey(std::string prompt) {
    return key;
 }
 
-inline char getKey(std::string prompt, std::string color) {
+inline char getKey(std::string prompt, const rgb& color) {
    print(prompt, color);
+   flush();
    setRawMode();
 
    char key = std::tolower(getchar());
@@ -192,20 +302,6 @@ inline bool getConsent(std::string prompt) {
    return getKey(prompt) == 'y';
 }
 
-inline bool getConsent(std::string prompt, std::string color) {
+inline bool getConsent(std::string prompt, const rgb& color) {
    return getKey(prompt, color) == 'y';
 }
-
-// Hash a string for security reasons, for example, a password. This code is not
-// by me and i don't understand how it works.
-inline std::string hashString(std::string prompt) {
-   unsigned char hash[SHA256_DIGEST_LENGTH];
-   SHA256((unsigned char*)prompt.c_str(), prompt.size(), hash);
-   
-   std::stringstream ss;
-   for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-      ss << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
-   }
-
-   return ss.str();
-}
\ No newline at end of file
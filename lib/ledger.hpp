@@ -0,0 +1,475 @@
+#pragma once
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <string>
+
+#include "database.hpp"
+
+// One transfer in the binary ledger. Every record has the same size, so the
+// record with a given id is found at (id - 1) * sizeof(ledgerRecord). Records
+// also point back at the previous record of their sender and receiver, which
+// chains the history of every account through the file.
+struct ledgerRecord {
+   int64_t id, date, prevSender, prevReceiver;
+   int32_t sender, receiver;
+   Money amount;
+};
+static_assert(sizeof(ledgerRecord) == 48, "ledger records must stay 48 bytes");
+
+// A file mapped into memory, remapped whenever more of it is needed.
+class MappedFile {
+public:
+   MappedFile() : fd(-1), data(nullptr), mapped(0), writable(false) {}
+
+   ~MappedFile() {
+      if (data) munmap(data, mapped);
+      if (fd >= 0) close(fd);
+   }
+
+   // Open or create the file, returns false if it could not be opened.
+   bool open(const std::string& fileName, bool writable) {
+      this->writable = writable;
+      fd = ::open(fileName.c_str(), O_RDWR | O_CREAT, 0644);
+      return fd >= 0;
+   }
+
+   // Get the size of the file in bytes.
+   size_t size() const {
+      struct stat info;
+      return (fstat(fd, &info) == 0) ? info.st_size : 0;
+   }
+
+   // Make sure the first bytes of the file are mapped. The mapping grows to
+   // at least twice its size, so appending to the file remaps rarely. Only
+   // the part that is within the file may be read.
+   bool map(size_t bytes) {
+      if (bytes <= mapped) return true;
+
+      size_t length = std::max(bytes, mapped * 2);
+      int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+      void* next = mmap(nullptr, length, protection, MAP_SHARED, fd, 0);
+      if (next == MAP_FAILED) return false;
+
+      if (data) munmap(data, mapped);
+      data = static_cast<char*>(next);
+      mapped = length;
+      return true;
+   }
+
+   int fd;
+   char* data;
+   size_t mapped;
+
+private:
+   bool writable;
+};
+
+// Keeps the ledger in an append-only file of fixed size records instead of
+// SQLite, the balances still live in the accounts table. Transfers are held
+// per connection until its write transaction is about to commit, and are then
+// written and flushed to disk while the connection still holds the write
+// lock. The record count is stored in LEDGER_FILES by the same transaction, so
+// records of a transaction that never committed are dropped when the ledger
+// is opened again, and a rollback truncates them right away.
+//
+// A second file maps every account id to its latest record, so reading a
+// history follows the chain of that account without scanning the ledger. It
+// is rebuilt from the ledger whenever it was not closed cleanly. The ids of
+// an account's records are kept in memory once its history was read, so
+// pages are found without walking the chain again.
+class FileLedger : public LedgerStore {
+public:
+   // Open or create the ledger in the given file, the index is kept next to
+   // it. Names are looked up in the accounts table. Without syncing, commits
+   // are left to the operating system to write out, like SQLite's NORMAL mode.
+   FileLedger(std::string fileName, Connection& conn, Accounts& acc,
+   bool sync = true)
+   : acc(acc), fileName(fileName), sync(sync), count(0) {
+      if (!log.open(fileName, false) || !index.open(fileName + ".idx", true)) {
+         println("Could not open ledger '" + fileName + "'.", RED);
+         exit(-4);
+      }
+
+      // Drop a record that was only partially written.
+      size_t size = log.size();
+      count = size / sizeof(ledgerRecord);
+      if (size % sizeof(ledgerRecord) != 0) {
+         if (ftruncate(log.fd, count * sizeof(ledgerRecord)) != 0) exit(-4);
+      }
+      if (!recover(conn)) {
+         println("Could not recover ledger '" + fileName + "'.", RED);
+         exit(-4);
+      }
+
+      if (!openIndex()) {
+         println("Could not open ledger index '" + fileName + ".idx'.", RED);
+         exit(-4);
+      }
+   }
+
+   // Flush everything and mark the index as clean, so it is trusted the next
+   // time the ledger is opened.
+   ~FileLedger() {
+      std::lock_guard<std::mutex> lock(mutex);
+      fdatasync(log.fd);
+      header()[0] = count;
+      header()[1] = 1;
+      msync(index.data, index.mapped, MS_SYNC);
+   }
+
+   // Hold the transfer until the write transaction of the connection commits.
+   bool append(Connection& on, const transaction& trans) override {
+      std::lock_guard<std::mutex> lock(mutex);
+      staged[&on].push_back(trans);
+      return true;
+   }
+
+   // Write the transfers held for the connection and store the new record
+   // count in its write transaction, then wait until they are on disk.
+   bool flush(Connection& on) override {
+      std::unique_lock<std::mutex> lock(mutex);
+      auto found = staged.find(&on);
+      if (found == staged.end()) return true;
+
+      std::vector<transaction> pending = std::move(found->second);
+      staged.erase(found);
+      written& undo = prepared[&on];
+      undo.from = count;
+      if (!write(pending, undo.heads) || !store(on)) {
+         println("Could not write the ledger '" + fileName + "'.", RED);
+         return false;
+      }
+      if (!sync) return true;
+
+      // Only the connection holding the write lock gets here, so readers can
+      // go on while it waits for the disk.
+      lock.unlock();
+      if (fdatasync(log.fd) != 0) {
+         println("Could not flush the ledger '" + fileName + "'.", RED);
+         return false;
+      }
+      return true;
+   }
+
+   // The records written for the connection were committed, so they stay.
+   bool commit(Connection& on) override {
+      std::lock_guard<std::mutex> lock(mutex);
+      prepared.erase(&on);
+      return true;
+   }
+
+   // Drop the transfers held for the connection, and the records already
+   // written for it. Only the connection holding the write lock can be between
+   // flush and commit, so its records are the end of the file.
+   void discard(Connection& on) override {
+      std::lock_guard<std::mutex> lock(mutex);
+      staged.erase(&on);
+      auto found = prepared.find(&on);
+      if (found == prepared.end()) return;
+
+      count = found->second.from;
+      if (ftruncate(log.fd, count * sizeof(ledgerRecord)) != 0) {
+         println("Could not truncate the ledger '" + fileName + "'.", RED);
+      }
+      for (auto& [accountId, id] : found->second.heads) {
+         setHead(accountId, id);
+         auto cached = histories.find(accountId);
+         if (cached == histories.end()) continue;
+         while (!cached->second.empty() && cached->second.back() > count) {
+            cached->second.pop_back();
+         }
+      }
+      prepared.erase(found);
+   }
+
+   // The head of the account's chain is its latest transaction.
+   transaction latest(int userId) override {
+      std::unordered_map<int, std::string_view> names;
+      ledgerRecord rec;
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         const ledgerRecord* found = record(head(userId));
+         if (found == nullptr) return transaction();
+         rec = *found;
+      }
+      return convert(rec, names);
+   }
+
+   // Finds the cursor in the ids of the account's records with a binary
+   // search, so a page costs as much as its own records.
+   std::pmr::vector<transaction> page(int userId, historyCursor& cursor,
+   int limit, std::pmr::memory_resource* memory) override {
+      std::pmr::vector<ledgerRecord> records(memory);
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         const std::vector<int64_t>& ids = history(userId);
+         auto next = std::upper_bound(ids.begin(), ids.end(), cursor.id);
+         for (; next != ids.end() && int(records.size()) < limit; ++next) {
+            const ledgerRecord* rec = record(*next);
+            if (rec == nullptr) break;
+            records.push_back(*rec);
+         }
+      }
+
+      std::unordered_map<int, std::string_view> names;
+      std::pmr::vector<transaction> rows(memory);
+      rows.reserve(records.size());
+      for (const ledgerRecord& rec : records) rows.push_back(convert(rec, names));
+      if (rows.size() > 0) {
+         cursor.date = rows.back().date;
+         cursor.id = rows.back().id;
+      }
+      return rows;
+   }
+
+   // Copies a page of records at a time, so the lock is not held while visit
+   // runs.
+   void forEach(int userId,
+   std::function<void(const transaction&)> visit) override {
+      std::vector<int64_t> ids;
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         ids = history(userId);
+      }
+
+      std::unordered_map<int, std::string_view> names;
+      std::vector<ledgerRecord> records;
+      for (size_t start = 0; start < ids.size(); start += HISTORY_PAGE_SIZE) {
+         size_t end = std::min(ids.size(), start + HISTORY_PAGE_SIZE);
+         records.clear();
+         {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = start; i < end; i++) {
+               const ledgerRecord* rec = record(ids[i]);
+               if (rec == nullptr) return;
+               records.push_back(*rec);
+            }
+         }
+         for (const ledgerRecord& rec : records) visit(convert(rec, names));
+      }
+   }
+
+private:
+   // Where the file ended before the records written for a connection, and
+   // the heads those records replaced.
+   struct written {
+      int64_t from;
+      std::unordered_map<int, int64_t> heads;
+   };
+
+   Accounts& acc;
+   std::string fileName;
+   MappedFile log, index;
+   bool sync;
+   int64_t count;
+   std::mutex mutex;
+   std::unordered_map<Connection*, std::vector<transaction>> staged;
+   std::unordered_map<Connection*, written> prepared;
+   std::unordered_map<int, std::vector<int64_t>> histories;
+
+   // Slots at the start of the index before the account heads: the record
+   // count when it was closed and whether it was closed cleanly.
+   static const int HEADER_SLOTS = 2;
+
+   // Get the header of the index.
+   int64_t* header() {
+      return reinterpret_cast<int64_t*>(index.data);
+   }
+
+   // Get the id of the latest record of an account, 0 if it has none.
+   int64_t head(int accountId) {
+      size_t slot = HEADER_SLOTS + accountId;
+      if (accountId < 0 || (slot + 1) * sizeof(int64_t) > index.mapped) {
+         return 0;
+      }
+      return header()[slot];
+   }
+
+   // Set the latest record of an account, growing the index if needed.
+   bool setHead(int accountId, int64_t id) {
+      size_t bytes = (HEADER_SLOTS + accountId + 1) * sizeof(int64_t);
+      if (bytes > index.mapped) {
+         size_t size = std::max(bytes, index.mapped * 2);
+         if (ftruncate(index.fd, size) != 0 || !index.map(size)) return false;
+      }
+      header()[HEADER_SLOTS + accountId] = id;
+      return true;
+   }
+
+   // Get a record by id, nullptr if it was not written or the ledger could not
+   // be mapped.
+   const ledgerRecord* record(int64_t id) {
+      if (id < 1 || id > count) return nullptr;
+      if (!log.map(count * sizeof(ledgerRecord))) {
+         println("Could not map the ledger '" + fileName + "'.", RED);
+         return nullptr;
+      }
+      return reinterpret_cast<const ledgerRecord*>(log.data) + id - 1;
+   }
+
+   // Get the ids of an account's records, oldest first. The chain is walked
+   // the first time, write keeps the ids up to date after that. None are
+   // found, and nothing is kept, if the chain could not be read.
+   const std::vector<int64_t>& history(int accountId) {
+      static const std::vector<int64_t> none;
+      auto found = histories.find(accountId);
+      if (found != histories.end()) return found->second;
+
+      std::vector<int64_t> ids;
+      for (int64_t id = head(accountId); id > 0;) {
+         ids.push_back(id);
+         const ledgerRecord* rec = record(id);
+         if (rec == nullptr) return none;
+         id = (rec->sender == accountId) ? rec->prevSender : rec->prevReceiver;
+      }
+      std::reverse(ids.begin(), ids.end());
+      return histories.emplace(accountId, std::move(ids)).first->second;
+   }
+
+   // Drop the records of transactions that never committed, the ones past the
+   // count stored by the last commit. Fewer records than that means committed
+   // transfers were lost, which can only be reported. Files without a stored
+   // count are trusted as they are.
+   bool recover(Connection& conn) {
+      sqlite3_stmt* stmt = conn.prepare(
+      "SELECT RECORDS FROM LEDGER_FILES WHERE NAME = ?;");
+      sqlite3_bind_text(stmt, 1, fileName.c_str(), -1, SQLITE_TRANSIENT);
+      int64_t committed = (sqlite3_step(stmt) == SQLITE_ROW)
+      ? sqlite3_column_int64(stmt, 0) : count;
+      sqlite3_reset(stmt);
+
+      if (count > committed) {
+         println("Dropping " + std::to_string(count - committed) + " records of "
+         "transactions that never committed from ledger '" + fileName + "'.",
+         RED);
+         if (ftruncate(log.fd, committed * sizeof(ledgerRecord)) != 0) {
+            return false;
+         }
+         count = committed;
+      }
+      else if (count < committed) {
+         println("Ledger '" + fileName + "' is missing "
+         + std::to_string(committed - count) + " committed transfers, the "
+         "balances no longer match it.", RED);
+      }
+      return true;
+   }
+
+   // Store the record count in the write transaction of the connection.
+   bool store(Connection& on) {
+      sqlite3_stmt* stmt = on.prepare(
+      "INSERT INTO LEDGER_FILES(NAME, RECORDS) VALUES(?1, ?2) "
+      "ON CONFLICT(NAME) DO UPDATE SET RECORDS = ?2;");
+      sqlite3_bind_text(stmt, 1, fileName.c_str(), -1, SQLITE_TRANSIENT);
+      sqlite3_bind_int64(stmt, 2, count);
+      return on.execute(stmt) == SQLITE_DONE;
+   }
+
+   // Map the index, and rebuild it from the ledger unless it was closed
+   // cleanly with the same amount of records. It is then marked as dirty on
+   // disk before anything is changed, so a crash always leads to a rebuild.
+   bool openIndex() {
+      size_t size = std::max(index.size(), size_t(4096));
+      if (ftruncate(index.fd, size) != 0 || !index.map(size)) return false;
+
+      if (header()[1] != 1 || header()[0] != count) {
+         std::fill(header(), header() + index.mapped / sizeof(int64_t), 0);
+         for (int64_t id = 1; id <= count; id++) {
+            const ledgerRecord* rec = record(id);
+            if (rec == nullptr || !setHead(rec->sender, id)
+            || !setHead(rec->receiver, id)) {
+               return false;
+            }
+         }
+      }
+
+      header()[1] = 0;
+      return msync(index.data, 4096, MS_SYNC) == 0;
+   }
+
+   // Append records for the transfers and point the account heads at them,
+   // keeping the heads they replaced in previous. The heads only move once the
+   // records are written.
+   bool write(const std::vector<transaction>& pending,
+   std::unordered_map<int, int64_t>& previous) {
+      std::vector<ledgerRecord> records(pending.size());
+      std::unordered_map<int, int64_t> heads;
+      auto latestOf = [&](int accountId) {
+         auto found = heads.find(accountId);
+         return (found != heads.end()) ? found->second : head(accountId);
+      };
+
+      for (size_t i = 0; i < pending.size(); i++) {
+         ledgerRecord& rec = records[i];
+         rec.id = count + 1 + i;
+         rec.date = time(nullptr);
+         rec.sender = pending[i].fromId;
+         rec.receiver = pending[i].toId;
+         rec.amount = pending[i].amount;
+         rec.prevSender = latestOf(rec.sender);
+         rec.prevReceiver = latestOf(rec.receiver);
+         heads[rec.sender] = heads[rec.receiver] = rec.id;
+      }
+
+      // Write every record with a single call, retrying partial writes.
+      const char* bytes = reinterpret_cast<const char*>(records.data());
+      size_t length = records.size() * sizeof(ledgerRecord), written = 0;
+      off_t offset = count * sizeof(ledgerRecord);
+      while (written < length) {
+         ssize_t result = pwrite(log.fd, bytes + written, length - written,
+         offset + written);
+         if (result < 0 && errno == EINTR) continue;
+         if (result <= 0) return false;
+         written += result;
+      }
+
+      count += records.size();
+      for (auto& [accountId, id] : heads) {
+         previous.emplace(accountId, head(accountId));
+         if (!setHead(accountId, id)) return false;
+      }
+
+      // Histories that were read already get the new records too.
+      for (const ledgerRecord& rec : records) {
+         for (int accountId : {rec.sender, rec.receiver}) {
+            auto cached = histories.find(accountId);
+            if (cached == histories.end()) continue;
+            if (cached->second.empty() || cached->second.back() != rec.id) {
+               cached->second.push_back(rec.id);
+            }
+         }
+      }
+      return true;
+   }
+
+   // Convert a record to a transaction, looking up names at most once per
+   // account and call.
+   transaction convert(const ledgerRecord& rec,
+   std::unordered_map<int, std::string_view>& names) {
+      return transaction(rec.id, rec.sender, rec.receiver, rec.amount, rec.date,
+      name(rec.sender, names), name(rec.receiver, names));
+   }
+
+   // Get the interned name of an account through the accounts table and its
+   // cache.
+   std::string_view name(int accountId,
+   std::unordered_map<int, std::string_view>& names) {
+      auto found = names.find(accountId);
+      if (found != names.end()) return found->second;
+
+      std::pmr::vector<account> accounts = acc.selectById(accountId);
+      std::string_view name = nameTable.intern(accounts.empty()
+      ? std::string_view("DELETED") : std::string_view(accounts.at(0).name));
+      names.emplace(accountId, name);
+      return name;
+   }
+};
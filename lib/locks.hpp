@@ -0,0 +1,39 @@
+#pragma once
+#include <array>
+#include <mutex>
+
+// Amount of mutexes accounts are spread over.
+const int LOCK_STRIPES = 256;
+
+// Both locks of a transfer, released when it goes out of scope.
+struct pairLock {
+   std::unique_lock<std::mutex> first, second;
+};
+
+// Per-account locks for transfers running on several threads. Accounts are
+// spread over a fixed amount of mutexes, so two accounts can share one.
+class LockManager {
+public:
+   // Lock the two accounts of a transfer. The stripes are always taken in
+   // ascending order, so transfers between the same accounts in opposite
+   // directions cannot deadlock. Accounts sharing a stripe lock it only once.
+   pairLock lockPair(int fromId, int toId) {
+      int first = stripe(fromId), second = stripe(toId);
+      if (first > second) std::swap(first, second);
+
+      pairLock locks;
+      locks.first = std::unique_lock<std::mutex>(stripes[first]);
+      if (first != second) {
+         locks.second = std::unique_lock<std::mutex>(stripes[second]);
+      }
+      return locks;
+   }
+
+private:
+   std::array<std::mutex, LOCK_STRIPES> stripes;
+
+   // Get the stripe of an account.
+   int stripe(int id) const {
+      return (unsigned int)id % LOCK_STRIPES;
+   }
+};
@@ -0,0 +1,241 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#include "connection.hpp"
+#include "io.hpp"
+#include "sqlite3.h"
+
+// Where the metrics are written when the program exits.
+const std::string METRICS_FILE = "database/metrics.json";
+
+// Operations that are timed.
+enum class operation {
+   PREPARE, STEP, COMMIT, TRANSFER, LOGIN, HISTORY, REPORT, ARCHIVE, COUNT
+};
+
+// Names of the operations, in the same order.
+const char* const OPERATION_NAMES[] = {
+   "prepare", "step", "commit", "transfer", "login", "history", "report",
+   "archive"
+};
+
+// Histogram of latencies in nanoseconds with a fixed relative precision. Small
+// values get a bucket each, larger ones are split into 16 buckets per power of
+// two, so every bucket is within about 6% of the values in it. Recording is a
+// few atomic additions, so it is safe and cheap from several threads.
+class LatencyHistogram {
+public:
+   // Add a single latency.
+   void record(uint64_t ns, bool ok = true) {
+      counts[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+      total.fetch_add(1, std::memory_order_relaxed);
+      sum.fetch_add(ns, std::memory_order_relaxed);
+      if (!ok) failures.fetch_add(1, std::memory_order_relaxed);
+
+      uint64_t seen = highest.load(std::memory_order_relaxed);
+      while (ns > seen && !highest.compare_exchange_weak(seen, ns,
+      std::memory_order_relaxed)) {}
+   }
+
+   // Get the amount of latencies recorded, and how many of them failed.
+   uint64_t count() const { return total.load(std::memory_order_relaxed); }
+   uint64_t failed() const { return failures.load(std::memory_order_relaxed); }
+
+   // Get the longest latency.
+   uint64_t max() const { return highest.load(std::memory_order_relaxed); }
+
+   // Get the average latency.
+   double mean() const {
+      uint64_t recorded = count();
+      return recorded ? double(sum.load(std::memory_order_relaxed)) / recorded
+      : 0;
+   }
+
+   // Get the latency at the given percentile, between 0 and 1. The result is
+   // the middle of the bucket it falls in.
+   uint64_t percentile(double p) const {
+      uint64_t recorded = count();
+      if (recorded == 0) return 0;
+
+      uint64_t rank = std::max<uint64_t>(1, std::ceil(p * recorded)), seen = 0;
+      for (int bucket = 0; bucket < BUCKETS; bucket++) {
+         seen += counts[bucket].load(std::memory_order_relaxed);
+         if (seen >= rank) return std::min(valueOf(bucket), max());
+      }
+      return max();
+   }
+
+private:
+   static const int SUB_BITS = 4;
+   static const int SUB_BUCKETS = 1 << SUB_BITS;
+   static const int BUCKETS = 64 * SUB_BUCKETS;
+
+   std::array<std::atomic<uint64_t>, BUCKETS> counts{};
+   std::atomic<uint64_t> total{0}, sum{0}, highest{0}, failures{0};
+
+   // Values below 32 have a bucket each, the rest keep their top 5 bits.
+   static int bucketOf(uint64_t ns) {
+      if (ns < 2 * SUB_BUCKETS) return int(ns);
+      int shift = std::bit_width(ns) - 1 - SUB_BITS;
+      return shift * SUB_BUCKETS + int(ns >> shift);
+   }
+
+   // Get the middle of the values in a bucket.
+   static uint64_t valueOf(int bucket) {
+      if (bucket < 2 * SUB_BUCKETS) return bucket;
+      int shift = bucket / SUB_BUCKETS - 1;
+      uint64_t low = uint64_t(bucket % SUB_BUCKETS + SUB_BUCKETS) << shift;
+      return low + (uint64_t(1) << shift) / 2;
+   }
+};
+
+// Latency histograms of every operation. Safe to use from several threads.
+class Metrics {
+public:
+   // Record how long an operation took and whether it succeeded.
+   void record(operation op, uint64_t ns, bool ok = true) {
+      histograms[int(op)].record(ns, ok);
+   }
+
+   // Get the histogram of an operation.
+   const LatencyHistogram& histogram(operation op) const {
+      return histograms[int(op)];
+   }
+
+private:
+   std::array<LatencyHistogram, int(operation::COUNT)> histograms;
+};
+
+inline Metrics metrics;
+
+// Times an operation from construction until it goes out of scope.
+class OperationTimer {
+public:
+   OperationTimer(operation op)
+   : op(op), ok(true), start(std::chrono::steady_clock::now()) {}
+
+   OperationTimer(const OperationTimer&) = delete;
+   OperationTimer& operator=(const OperationTimer&) = delete;
+
+   ~OperationTimer() {
+      auto elapsed = std::chrono::steady_clock::now() - start;
+      metrics.record(op, std::chrono::duration_cast<std::chrono::nanoseconds>(
+         elapsed).count(), ok);
+   }
+
+   // Count the operation as failed.
+   void fail() {
+      ok = false;
+   }
+
+private:
+   operation op;
+   bool ok;
+   std::chrono::steady_clock::time_point start;
+};
+
+// Counters SQLite keeps about a connection and the whole process.
+struct sqliteStatus {
+   int cacheHits, cacheMisses, cacheWrites, cacheUsed, schemaUsed,
+   statementsUsed, lookasideUsed;
+   long long memoryUsed, memoryPeak;
+
+   // Read the counters of the given connection.
+   sqliteStatus(sqlite3* db) {
+      cacheHits = read(db, SQLITE_DBSTATUS_CACHE_HIT);
+      cacheMisses = read(db, SQLITE_DBSTATUS_CACHE_MISS);
+      cacheWrites = read(db, SQLITE_DBSTATUS_CACHE_WRITE);
+      cacheUsed = read(db, SQLITE_DBSTATUS_CACHE_USED);
+      schemaUsed = read(db, SQLITE_DBSTATUS_SCHEMA_USED);
+      statementsUsed = read(db, SQLITE_DBSTATUS_STMT_USED);
+      lookasideUsed = read(db, SQLITE_DBSTATUS_LOOKASIDE_USED);
+
+      sqlite3_int64 current = 0, peak = 0;
+      sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &current, &peak, 0);
+      memoryUsed = current;
+      memoryPeak = peak;
+   }
+
+private:
+   static int read(sqlite3* db, int counter) {
+      int current = 0, peak = 0;
+      sqlite3_db_status(db, counter, &current, &peak, 0);
+      return current;
+   }
+};
+
+// Convert nanoseconds to a string of microseconds.
+inline std::string micros(double ns) {
+   return std::to_string(ns / 1000);
+}
+
+// Convert the operation histograms, the statement cache and the SQLite
+// counters of a connection to a JSON object.
+inline std::string metricsJson(Connection& conn) {
+   std::string out = "{\"operations\": {";
+   for (int i = 0; i < int(operation::COUNT); i++) {
+      const LatencyHistogram& hist = metrics.histogram(operation(i));
+      if (i > 0) out += ", ";
+      out += "\"" + str(OPERATION_NAMES[i]) + "\": {\"count\": "
+      + std::to_string(hist.count()) + ", \"failed\": "
+      + std::to_string(hist.failed()) + ", \"mean_us\": "
+      + micros(hist.mean()) + ", \"p50_us\": " + micros(hist.percentile(0.5))
+      + ", \"p99_us\": " + micros(hist.percentile(0.99)) + ", \"p999_us\": "
+      + micros(hist.percentile(0.999)) + ", \"max_us\": " + micros(hist.max())
+      + "}";
+   }
+
+   cacheStats statements = conn.statementStats();
+   sqliteStatus status(conn.handle());
+   return out + "}, \"statements\": {\"hits\": "
+   + std::to_string(statements.hits) + ", \"misses\": "
+   + std::to_string(statements.misses) + "}, \"sqlite\": {\"cache_hit\": "
+   + str(status.cacheHits) + ", \"cache_miss\": " + str(status.cacheMisses)
+   + ", \"cache_write\": " + str(status.cacheWrites) + ", \"cache_used\": "
+   + str(status.cacheUsed) + ", \"schema_used\": " + str(status.schemaUsed)
+   + ", \"stmt_used\": " + str(status.statementsUsed)
+   + ", \"lookaside_used\": " + str(status.lookasideUsed)
+   + ", \"memory_used\": " + std::to_string(status.memoryUsed)
+   + ", \"memory_peak\": " + std::to_string(status.memoryPeak) + "}}";
+}
+
+// Print the operation latencies and the SQLite counters as a table.
+inline void printMetrics(Connection& conn) {
+   println("operation count failed mean_us p50_us p99_us max_us", BLUE);
+   for (int i = 0; i < int(operation::COUNT); i++) {
+      const LatencyHistogram& hist = metrics.histogram(operation(i));
+      println(str(OPERATION_NAMES[i]) + " " + std::to_string(hist.count()) + " "
+      + std::to_string(hist.failed()) + " " + str(int(hist.mean() / 1000)) + " "
+      + str(int(hist.percentile(0.5) / 1000)) + " "
+      + str(int(hist.percentile(0.99) / 1000)) + " "
+      + str(int(hist.max() / 1000)));
+   }
+
+   cacheStats statements = conn.statementStats();
+   sqliteStatus status(conn.handle());
+   println("statements: " + std::to_string(statements.hits) + " hits, "
+   + std::to_string(statements.misses) + " misses", BLUE);
+   println("page cache: " + str(status.cacheHits) + " hits, "
+   + str(status.cacheMisses) + " misses, " + str(status.cacheWrites)
+   + " writes, " + str(status.cacheUsed) + " bytes", BLUE);
+   println("sqlite memory: " + std::to_string(status.memoryUsed) + " bytes, "
+   + std::to_string(status.memoryPeak) + " at most", BLUE);
+}
+
+// Write the metrics of a connection to a JSON file.
+inline bool writeMetrics(Connection& conn,
+const std::string& fileName = METRICS_FILE) {
+   std::ofstream file(fileName);
+   if (file << metricsJson(conn) << "\n") return true;
+
+   println("Could not write metrics to '" + fileName + "'.", RED);
+   return false;
+}
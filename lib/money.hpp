@@ -0,0 +1,194 @@
+#pragma once
+#include <compare>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "io.hpp"
+
+// Cents in a dollar.
+const int64_t CENTS_PER_DOLLAR = 100;
+
+// Most characters a formatted amount takes, '-92233720368547758.08'.
+const size_t MONEY_CHARS = 24;
+
+// Two digit strings of the numbers 0 to 99, so formatting writes two digits
+// at a time.
+inline constexpr char DIGIT_PAIRS[] =
+"00010203040506070809101112131415161718192021222324252627282930313233343536"
+"37383940414243444546474849505152535455565758596061626364656667686970717273"
+"7475767778798081828384858687888990919293949596979899";
+
+// An amount of money, stored as a whole number of cents. Adding and
+// subtracting are checked, an amount that would not fit is reported instead
+// of wrapping around.
+class Money {
+public:
+   constexpr Money(): value(0) {}
+
+   // Make an amount of the given cents.
+   constexpr explicit Money(int64_t cents): value(cents) {}
+
+   // Make an amount of whole dollars.
+   static constexpr Money dollars(int64_t dollars) {
+      return Money(dollars * CENTS_PER_DOLLAR);
+   }
+
+   // Get the amount in cents.
+   constexpr int64_t cents() const {
+      return value;
+   }
+
+   // Add or subtract another amount. Returns false and leaves the amount
+   // unchanged if the result does not fit.
+   constexpr bool add(Money other) {
+      int64_t result = 0;
+      if (__builtin_add_overflow(value, other.value, &result)) return false;
+      value = result;
+      return true;
+   }
+
+   constexpr bool subtract(Money other) {
+      int64_t result = 0;
+      if (__builtin_sub_overflow(value, other.value, &result)) return false;
+      value = result;
+      return true;
+   }
+
+   constexpr auto operator<=>(const Money&) const = default;
+
+   // Write the amount as dollars with two decimals, like '-12.05', without
+   // building any strings. Out needs room for MONEY_CHARS characters. Returns
+   // the amount of characters written.
+   size_t format(char* out) const {
+      char digits[MONEY_CHARS];
+      char* end = digits + sizeof(digits);
+      char* start = end;
+
+      // The magnitude is unsigned, so the smallest amount does not overflow.
+      uint64_t left = (value < 0) ? 0 - uint64_t(value) : uint64_t(value);
+      uint64_t cents = left % CENTS_PER_DOLLAR;
+      left /= CENTS_PER_DOLLAR;
+
+      start -= 2;
+      memcpy(start, DIGIT_PAIRS + cents * 2, 2);
+      *--start = '.';
+      while (left >= 100) {
+         start -= 2;
+         memcpy(start, DIGIT_PAIRS + left % 100 * 2, 2);
+         left /= 100;
+      }
+      if (left >= 10) {
+         start -= 2;
+         memcpy(start, DIGIT_PAIRS + left * 2, 2);
+      }
+      else *--start = char('0' + left);
+      if (value < 0) *--start = '-';
+
+      memcpy(out, start, end - start);
+      return end - start;
+   }
+
+   // Append the formatted amount to out.
+   void appendTo(std::string& out) const {
+      char text[MONEY_CHARS];
+      out.append(text, format(text));
+   }
+
+   // Convert to formal string.
+   std::string string() const {
+      char text[MONEY_CHARS];
+      return std::string(text, format(text));
+   }
+
+   // Read an amount of dollars with up to two decimals, like '12', '12.5' or
+   // '-0.05'. Returns false if the text is not an amount or it does not fit.
+   static bool parse(std::string_view text, Money& out) {
+      bool negative = !text.empty() && text[0] == '-';
+      if (negative) text.remove_prefix(1);
+
+      size_t dot = text.find('.');
+      std::string_view whole = text.substr(0, dot);
+      std::string_view fraction = (dot == std::string_view::npos)
+      ? std::string_view() : text.substr(dot + 1);
+      if (whole.empty() || fraction.size() > 2
+      || (dot != std::string_view::npos && fraction.empty())) {
+         return false;
+      }
+
+      Money amount;
+      for (char c : whole) {
+         if (c < '0' || c > '9') return false;
+         int64_t dollars = 0;
+         if (__builtin_mul_overflow(amount.value, 10, &dollars)
+         || __builtin_add_overflow(dollars, c - '0', &amount.value)) {
+            return false;
+         }
+      }
+      if (__builtin_mul_overflow(amount.value, CENTS_PER_DOLLAR, &amount.value)) {
+         return false;
+      }
+
+      int64_t cents = 0;
+      for (size_t i = 0; i < 2; i++) {
+         char c = (i < fraction.size()) ? fraction[i] : '0';
+         if (c < '0' || c > '9') return false;
+         cents = cents * 10 + (c - '0');
+      }
+      if (!amount.add(Money(cents))) return false;
+
+      out = negative ? Money(-amount.value) : amount;
+      return true;
+   }
+
+   // Add up many amounts. The overflow of every addition is collected instead
+   // of checked on the way, so the loop has no branches. Returns false if the
+   // total does not fit.
+   static bool sum(std::span<const Money> amounts, Money& total) {
+      int64_t result = 0;
+      bool overflowed = false;
+      for (const Money& amount : amounts) {
+         overflowed |= __builtin_add_overflow(result, amount.value, &result);
+      }
+      total = Money(result);
+      return !overflowed;
+   }
+
+private:
+   int64_t value;
+};
+
+// Columns of amounts are read straight from files as arrays of Money.
+static_assert(sizeof(Money) == sizeof(int64_t)
+&& std::is_trivially_copyable_v<Money>, "money must stay a plain int64");
+
+// Checked arithmetic works at compile time too.
+static_assert(!Money(INT64_MAX).add(Money(1))
+&& Money::dollars(5) < Money(501));
+
+// Convert an amount to string.
+inline std::string str(Money amount) {
+   return amount.string();
+}
+
+// Get an amount of money from the user.
+inline Money getMoney(std::string prompt) {
+   Money amount;
+   std::string input = getInput(prompt);
+   while (!Money::parse(input, amount)) {
+      input = getInput("Invalid amount. Please try again > ", RED);
+   }
+   return amount;
+}
+
+inline Money getMoney(std::string prompt, const rgb& color) {
+   Money amount;
+   std::string input = getInput(prompt, color);
+   while (!Money::parse(input, amount)) {
+      input = getInput("Invalid amount. Please try again > ", RED);
+   }
+   return amount;
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// Largest payload of a single frame.
+const uint32_t MAX_FRAME = 1 << 20;
+
+// Size of the length in front of every frame.
+const size_t FRAME_HEADER = 4;
+
+// Sockets waiting to be accepted.
+const int LISTEN_BACKLOG = 4096;
+
+// First byte of a response, whether the command succeeded.
+const char STATUS_OK = '+';
+const char STATUS_FAILED = '-';
+
+// Append a frame to out: the length of the payload as 4 bytes in network
+// order, followed by the payload.
+inline void appendFrame(std::string& out, std::string_view payload) {
+   uint32_t length = htonl(payload.size());
+   out.append(reinterpret_cast<const char*>(&length), FRAME_HEADER);
+   out.append(payload);
+}
+
+// Find the next whole frame in buffer starting at offset. Returns 1 and moves
+// offset past it if there is one, 0 if more bytes are needed and -1 if the
+// frame is larger than MAX_FRAME.
+inline int nextFrame(const std::string& buffer, size_t& offset,
+std::string_view& payload) {
+   if (buffer.size() - offset < FRAME_HEADER) return 0;
+
+   uint32_t length;
+   memcpy(&length, buffer.data() + offset, FRAME_HEADER);
+   length = ntohl(length);
+   if (length > MAX_FRAME) return -1;
+   if (buffer.size() - offset - FRAME_HEADER < length) return 0;
+
+   payload = std::string_view(buffer.data() + offset + FRAME_HEADER, length);
+   offset += FRAME_HEADER + length;
+   return 1;
+}
+
+// Allow as many open files as the system lets this process have, every
+// connection takes one.
+inline void raiseFileLimit() {
+   rlimit limit;
+   if (getrlimit(RLIMIT_NOFILE, &limit) != 0) return;
+   limit.rlim_cur = limit.rlim_max;
+   setrlimit(RLIMIT_NOFILE, &limit);
+}
+
+// Make a socket return right away instead of blocking.
+inline bool setNonBlocking(int fd) {
+   int flags = fcntl(fd, F_GETFL, 0);
+   return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// Open a socket for an address, either 'unix:<path>' or '[host:]port', and
+// either listen on it or connect to it. The host defaults to 127.0.0.1.
+// Returns the socket, or -1 if it could not be opened.
+inline int openSocket(const std::string& address, bool listening) {
+   int fd = -1;
+
+   if (address.rfind("unix:", 0) == 0) {
+      std::string path = address.substr(5);
+      sockaddr_un addr{};
+      if (path.empty() || path.size() >= sizeof(addr.sun_path)) return -1;
+      addr.sun_family = AF_UNIX;
+      memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+      fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (fd < 0) return -1;
+      if (listening) unlink(path.c_str());
+
+      sockaddr* raw = reinterpret_cast<sockaddr*>(&addr);
+      if ((listening ? bind(fd, raw, sizeof(addr)) : connect(fd, raw,
+      sizeof(addr))) != 0 || (listening && listen(fd, LISTEN_BACKLOG) != 0)) {
+         close(fd);
+         return -1;
+      }
+      return fd;
+   }
+
+   // Split the host from the port.
+   size_t colon = address.rfind(':');
+   std::string host = (colon == std::string::npos) ? "127.0.0.1"
+   : address.substr(0, colon);
+   std::string port = (colon == std::string::npos) ? address
+   : address.substr(colon + 1);
+
+   addrinfo hints{}, *found = nullptr;
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+   if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0) return -1;
+
+   for (addrinfo* info = found; info && fd < 0; info = info->ai_next) {
+      fd = socket(info->ai_family, info->ai_socktype | SOCK_CLOEXEC, 0);
+      if (fd < 0) continue;
+
+      int on = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+      if (listening) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+      if ((listening ? bind(fd, info->ai_addr, info->ai_addrlen)
+      : connect(fd, info->ai_addr, info->ai_addrlen)) != 0
+      || (listening && listen(fd, LISTEN_BACKLOG) != 0)) {
+         close(fd);
+         fd = -1;
+      }
+   }
+
+   freeaddrinfo(found);
+   return fd;
+}
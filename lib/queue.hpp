@@ -0,0 +1,205 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+
+#include "database.hpp"
+
+// Most transfers waiting in the queue before submitting blocks.
+const int QUEUE_CAPACITY = 4096;
+
+// Most transfers committed together.
+const int GROUP_COMMIT_SIZE = 256;
+
+// How long the writer waits for more transfers once it has one, in
+// microseconds.
+const int GROUP_COMMIT_WINDOW_US = 2000;
+
+// Describe why a transfer did not go through.
+inline std::string transferError(transferStatus status) {
+   switch (status) {
+   case transferStatus::INVALID_AMOUNT:
+      return "Amount must be between " + str(MIN_AMOUNT) + "$ and "
+      + str(MAX_AMOUNT) + "$.";
+   case transferStatus::MISSING_ACCOUNT:
+      return "One or both of the users does not exist.";
+   case transferStatus::INSUFFICIENT_FUNDS:
+      return "Sender does not have enough money.";
+   default:
+      return "Could not create transaction.";
+   }
+}
+
+// Commits transfers in the background. Any thread can submit transfers, a
+// single writer thread takes them off the queue and commits them in groups,
+// waiting until either the group is full or the window has passed since the
+// first transfer of the group arrived. The writer has its own connection with
+// synchronous set to FULL, so a transfer is only reported once its commit is
+// on disk.
+class TransferQueue {
+public:
+   // Open a connection to the file for the writer. Accounts changed by the
+   // transfers are dropped from the cache of notify, which may belong to
+   // another thread.
+   TransferQueue(Accounts& notify, const std::string& fileName = DATABASE_FILE,
+   int capacity = QUEUE_CAPACITY, int groupSize = GROUP_COMMIT_SIZE,
+   int windowUs = GROUP_COMMIT_WINDOW_US)
+   : notify(notify), conn(fileName, "FULL"), db(conn, 0), tr(conn, db),
+   capacity(std::max(1, capacity)), groupSize(std::max(1, groupSize)),
+   window(windowUs), stopping(false), busy(false), groups(0), committed(0) {
+      waitWhenBusy(conn);
+      writer = std::thread([this]() { run(); });
+   }
+
+   // Commit everything that was submitted, then stop the writer.
+   ~TransferQueue() {
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         stopping = true;
+      }
+      ready.notify_one();
+      writer.join();
+   }
+
+   // Queue a transfer, done is called from the writer thread once it has been
+   // committed or has failed. Transfers with an amount outside of the limits
+   // are rejected right away. Blocks while the queue is full.
+   void submit(const transaction& trans,
+   std::function<void(transferStatus)> done) {
+      if (trans.amount < MIN_AMOUNT || trans.amount > MAX_AMOUNT) {
+         done(transferStatus::INVALID_AMOUNT);
+         return;
+      }
+
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         space.wait(lock, [&]() { return int(pending.size()) < capacity; });
+         pending.push_back({
+            trans, std::move(done), std::chrono::steady_clock::now()
+         });
+      }
+      ready.notify_one();
+   }
+
+   // Queue a transfer, the future holds its status once it has been committed
+   // or has failed.
+   std::future<transferStatus> submit(const transaction& trans) {
+      auto promise = std::make_shared<std::promise<transferStatus>>();
+      std::future<transferStatus> result = promise->get_future();
+      submit(trans, [promise](transferStatus status) {
+         promise->set_value(status);
+      });
+      return result;
+   }
+
+   // Wait until every transfer submitted so far has been committed.
+   void drain() {
+      std::unique_lock<std::mutex> lock(mutex);
+      idle.wait(lock, [&]() { return pending.empty() && !busy; });
+   }
+
+   // Get the amount of group commits and the transfers that succeeded in them.
+   long long commits() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return groups;
+   }
+
+   long long transfers() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return committed;
+   }
+
+private:
+   // A transfer waiting to be committed.
+   struct queuedTransfer {
+      transaction trans;
+      std::function<void(transferStatus)> done;
+      std::chrono::steady_clock::time_point queued;
+   };
+
+   Accounts& notify;
+   Connection conn;
+   Accounts db;
+   Transactions tr;
+   int capacity, groupSize;
+   std::chrono::microseconds window;
+
+   std::mutex mutex;
+   std::condition_variable ready, space, idle;
+   std::deque<queuedTransfer> pending;
+   bool stopping, busy;
+   long long groups, committed;
+   std::thread writer;
+
+   // Take groups off the queue and commit them until stopped and empty.
+   void run() {
+      std::vector<queuedTransfer> group;
+      std::vector<transaction> batch;
+
+      while (true) {
+         {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [&]() { return stopping || !pending.empty(); });
+            if (pending.empty()) return;
+
+            // Give the group until the window of its first transfer is over to
+            // fill up.
+            auto deadline = pending.front().queued + window;
+            ready.wait_until(lock, deadline, [&]() {
+               return stopping || int(pending.size()) >= groupSize;
+            });
+
+            while (!pending.empty() && int(group.size()) < groupSize) {
+               group.push_back(std::move(pending.front()));
+               pending.pop_front();
+            }
+            busy = true;
+         }
+         space.notify_all();
+
+         for (queuedTransfer& queued : group) batch.push_back(queued.trans);
+         std::vector<transferStatus> statuses =
+         tr.createTransactions(batch, batch.size());
+
+         // A transfer that failed outright rolled back the whole group, so the
+         // group is sent again one transfer at a time and only that transfer
+         // fails.
+         if (batch.size() > 1 && std::find(statuses.begin(), statuses.end(),
+         transferStatus::FAILED) != statuses.end()) {
+            for (size_t i = 0; i < batch.size(); i++) {
+               statuses[i] = tr.createTransactions(
+                  std::span<const transaction>(&batch[i], 1)
+               )[0];
+            }
+         }
+
+         long long succeeded = 0;
+         for (size_t i = 0; i < group.size(); i++) {
+            if (statuses[i] == transferStatus::OK) {
+               notify.invalidate(batch[i].fromId);
+               notify.invalidate(batch[i].toId);
+               succeeded++;
+            }
+            group[i].done(statuses[i]);
+         }
+
+         {
+            std::lock_guard<std::mutex> lock(mutex);
+            groups++;
+            committed += succeeded;
+            busy = false;
+         }
+         idle.notify_all();
+         group.clear();
+         batch.clear();
+      }
+   }
+};
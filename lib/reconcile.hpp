@@ -0,0 +1,148 @@
+#pragma once
+#include <vector>
+#include <string>
+
+#include "database.hpp"
+
+// Amount of new ledger rows after which a checkpoint is due.
+const int CHECKPOINT_INTERVAL = 10000;
+
+// An account whose stored balance does not match the ledger.
+struct balanceDrift {
+   int id;
+   Money balance, expected;
+
+   balanceDrift(): id(INVALID_ID) {}
+
+   balanceDrift(int id, Money balance, Money expected)
+   : id(id), balance(balance), expected(expected) {}
+
+   // Convert to formal string.
+   std::string string() const {
+      return "Id: " + str(id) + " balance " + str(balance) + "$, ledger says "
+      + str(expected) + "$";
+   }
+};
+
+// Checks the BALANCE column of the accounts against the transactions ledger.
+// A checkpoint stores every balance as of a ledger id, so checks only have to
+// add up the transactions after it instead of the whole history.
+class Reconciler : public Database {
+public:
+   // Use the given shared connection.
+   Reconciler(Connection& conn) : Database(conn) {}
+
+   // Get the id of the last transaction included in the checkpoint, or 0.
+   int lastCheckpoint() {
+      sqlite3_stmt* stmt = prepare(EPOCH);
+      int id = (sqlite3_step(stmt) == SQLITE_ROW) ? sqlite3_column_int(stmt, 0) : 0;
+      sqlite3_reset(stmt);
+      return id;
+   }
+
+   // Move the checkpoint to the latest transaction. The new balances come from
+   // the old checkpoint and the ledger, never from the BALANCE column, so drift
+   // is not written into the checkpoint.
+   bool checkpoint() {
+      if (!begin()) return false;
+
+      int from = lastCheckpoint();
+      int to = lastTransaction();
+      if (to > from) {
+         sqlite3_stmt* stmt = prepare(
+            "INSERT OR REPLACE INTO CHECKPOINTS "
+            "(ACCOUNT, BALANCE, LAST_TRANSACTION) SELECT ID, EXPECTED, ?2 FROM ("
+            + str(EXPECTED) + ");"
+         );
+         sqlite3_bind_int(stmt, 1, from);
+         sqlite3_bind_int(stmt, 2, to);
+
+         if (!handleInsertion(execute(stmt), "Could not create checkpoint: ")) {
+            rollback();
+            return false;
+         }
+      }
+
+      return commit();
+   }
+
+   // Create a checkpoint if enough transactions were made since the last one.
+   bool checkpointIfDue(int interval = CHECKPOINT_INTERVAL) {
+      if (lastTransaction() - lastCheckpoint() < interval) return true;
+      return checkpoint();
+   }
+
+   // Check a single account, reading only the transactions made after the
+   // checkpoint. Returns an invalid drift if the account does not exist.
+   balanceDrift reconcile(int id) {
+      // The unary plus keeps SQLite on the id range of the new transactions
+      // instead of the accounts whole history.
+      sqlite3_stmt* stmt = prepare(
+         "SELECT A.BALANCE, COALESCE(C.BALANCE, 0) + COALESCE(("
+         "SELECT SUM(CASE WHEN T.RECEIVER = ?1 THEN T.AMOUNT ELSE 0 END) "
+         "- SUM(CASE WHEN T.SENDER = ?1 THEN T.AMOUNT ELSE 0 END) "
+         "FROM TRANSACTIONS T WHERE T.ID > (" + str(EPOCH) + ") "
+         "AND (+T.SENDER = ?1 OR +T.RECEIVER = ?1)), 0) "
+         "FROM ACCOUNTS A LEFT JOIN CHECKPOINTS C ON C.ACCOUNT = A.ID "
+         "WHERE A.ID = ?1;"
+      );
+      sqlite3_bind_int(stmt, 1, id);
+
+      balanceDrift drift;
+      if (sqlite3_step(stmt) == SQLITE_ROW) {
+         drift = balanceDrift(id, Money(sqlite3_column_int64(stmt, 0)),
+            Money(sqlite3_column_int64(stmt, 1))
+         );
+      }
+      sqlite3_reset(stmt);
+      return drift;
+   }
+
+   // Check every account in a single pass over the transactions made after
+   // the checkpoint. Returns the accounts that drifted.
+   std::vector<balanceDrift> audit() {
+      sqlite3_stmt* stmt = prepare(
+         "SELECT ID, BALANCE, EXPECTED FROM (" + str(EXPECTED) + ") "
+         "WHERE BALANCE <> EXPECTED;"
+      );
+      sqlite3_bind_int(stmt, 1, lastCheckpoint());
+      sqlite3_bind_int64(stmt, 2, INT64_MAX);
+
+      std::vector<balanceDrift> drifts;
+      while (sqlite3_step(stmt) == SQLITE_ROW) {
+         drifts.push_back(balanceDrift(sqlite3_column_int(stmt, 0),
+            Money(sqlite3_column_int64(stmt, 1)),
+            Money(sqlite3_column_int64(stmt, 2))
+         ));
+      }
+      sqlite3_reset(stmt);
+      return drifts;
+   }
+
+private:
+   // Selects the id of the last transaction in the checkpoint.
+   static constexpr const char* EPOCH =
+   "SELECT COALESCE((SELECT LAST_TRANSACTION FROM CHECKPOINTS LIMIT 1), 0)";
+
+   // Selects the stored and the expected balance of every account, from the
+   // checkpoint plus the transactions with an id in (?1, ?2].
+   static constexpr const char* EXPECTED =
+   "SELECT A.ID, A.BALANCE, COALESCE(C.BALANCE, 0) + COALESCE(F.DELTA, 0) "
+   "AS EXPECTED FROM ACCOUNTS A "
+   "LEFT JOIN CHECKPOINTS C ON C.ACCOUNT = A.ID "
+   "LEFT JOIN (SELECT ACCOUNT, SUM(DELTA) AS DELTA FROM ("
+   "SELECT RECEIVER AS ACCOUNT, AMOUNT AS DELTA FROM TRANSACTIONS "
+   "WHERE ID > ?1 AND ID <= ?2 UNION ALL "
+   "SELECT SENDER, -AMOUNT FROM TRANSACTIONS WHERE ID > ?1 AND ID <= ?2"
+   ") GROUP BY ACCOUNT) F ON F.ACCOUNT = A.ID";
+
+   // Get the id of the latest transaction, or 0.
+   int lastTransaction() {
+      sqlite3_stmt* stmt = prepare(
+         "SELECT COALESCE(MAX(ID), 0) FROM TRANSACTIONS;"
+      );
+      int id = (sqlite3_step(stmt) == SQLITE_ROW) ? sqlite3_column_int(stmt, 0) : 0;
+      sqlite3_reset(stmt);
+      return id;
+   }
+};
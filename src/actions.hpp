@@ -1,5 +1,5 @@
 #pragma once
-#include "../lib/database.hpp"
+#include "../lib/queue.hpp"
 
 // Provide commands list to the user.
 inline void help() {
@@ -7,23 +7,41 @@ inline void help() {
       "> Q - quit\n> T - new transaction\n> R - last transaction\n"
       "> L - list all transactions\n> B - check balance\n"
       "> O - log out of your account\n> D - deposit money\n"
-      "> W - withdraw money\n> E - edit account\n", BLUE
+      "> W - withdraw money\n> E - edit account\n> S - monthly statement\n",
+      BLUE
    );
 }
 
+// Send a transfer and print success once it went through. With a queue the
+// transfer is committed in the background and the result is printed when it
+// is done, so the user does not have to wait for it.
+inline void sendTransfer(const transaction& trans, const std::string& success,
+Transactions& tr, TransferQueue* queue) {
+   if (queue == nullptr) {
+      if (tr.createTransaction(trans)) println(success, GREEN);
+      return;
+   }
+
+   queue->submit(trans, [success](transferStatus status) {
+      if (status == transferStatus::OK) println(success, GREEN);
+      else println(transferError(status), RED);
+      flush();
+   });
+}
+
 // Deposit some money into the account.
-inline void deposit(int id, Transactions& tr) {
-   int amount = getNumber("Amount to deposit > ", BLUE);
+inline void deposit(int id, Transactions& tr, TransferQueue* queue = nullptr) {
+   Money amount = getMoney("Amount to deposit > ", BLUE);
 
    // Create a transaction from BANK to user.
-   if (tr.createTransaction(transaction(amount, 1, id))) {
-      println("Successfully deposited " + str(amount) + "$.", GREEN);
-   }
+   sendTransfer(transaction(amount, 1, id),
+   "Successfully deposited " + str(amount) + "$.", tr, queue);
 }
 
 // Withdraw money from the account.
-inline void withdraw(account& acc, Transactions& tr) {
-   int amount = getNumber("Amount to withdraw > ", BLUE);
+inline void withdraw(account& acc, Transactions& tr,
+TransferQueue* queue = nullptr) {
+   Money amount = getMoney("Amount to withdraw > ", BLUE);
 
    // Not enough money in bank account.
    if (acc.balance < amount) {
@@ -33,9 +51,8 @@ inline void withdraw(account& acc, Transactions& tr) {
    }
 
    // Create a transaction from user to BANK.
-   if (tr.createTransaction(transaction(amount, acc.id, 1))) {
-      println("Successfully withdraw " + str(amount) + "$.", GREEN);
-   }
+   sendTransfer(transaction(amount, acc.id, 1),
+   "Successfully withdraw " + str(amount) + "$.", tr, queue);
 }
 
 // Update accounts age.
@@ -61,7 +78,7 @@ inline void editPassword(account& acc, Accounts& db) {
    std::string pass = getHiddenInput("Input your old password > ", BLUE);
 
    // Passwords don't match.
-   if (acc.pass != hashString(pass)) {
+   if (!verifyPassword(pass, acc.pass)) {
       println("Incorrect password.", RED);
       return;
    }
@@ -74,7 +91,9 @@ inline void editPassword(account& acc, Accounts& db) {
       return;
    }
 
-   if (db.updatePass(hashString(newPass), acc.id)) {
+   std::string hashed = hashPassword(newPass);
+   if (db.updatePass(hashed, acc.id)) {
+      acc.pass = hashed;
       println("Successfully updated password.", GREEN);
    }
 }
@@ -113,7 +132,8 @@ inline void editAccount(account& acc, Accounts& db) {
 }
 
 // Send money to a different user.
-inline void createTransaction(account& acc, Accounts& db, Transactions& tr) {
+inline void createTransaction(account& acc, Accounts& db, Transactions& tr,
+TransferQueue* queue = nullptr) {
    // Get receivers account.
    std::string username = getInput("Username to send the money to > ", BLUE);
    account receiver = db.selectByName(username);
@@ -125,8 +145,8 @@ inline void createTransaction(account& acc, Accounts& db, Transactions& tr) {
    }
 
    // Get amount to be sent.
-   int amount = getNumber("Amount to send (you have " + str(acc.balance) + "$) "
-   "> ", BLUE);
+   Money amount = getMoney("Amount to send (you have " + str(acc.balance)
+   + "$) > ", BLUE);
 
    // Amount sent is above the accounts balance.
    if (acc.balance < amount) {
@@ -135,30 +155,67 @@ inline void createTransaction(account& acc, Accounts& db, Transactions& tr) {
    }
 
    // Create transaction and update account.
-   if (tr.createTransaction(transaction(amount, acc.id, receiver.id))) {
-      println("Successfully sent " + str(amount) + "$ to '" 
-      + receiver.name + "'.", GREEN);
-   }
+   sendTransfer(transaction(amount, acc.id, receiver.id),
+   "Successfully sent " + str(amount) + "$ to '" + std::string(receiver.name)
+   + "'.", tr, queue);
 }
 
-// Print the latest transaction.
+// Print the latest transaction, looking through the archives if there is
+// nothing newer.
 inline void lastTransaction(int id, Transactions& tr) {
-   transaction trans = tr.getLatestTransaction(id);
-   std::string color = (trans.fromId == id) ? RED : GREEN;
+   transaction trans = tr.getLatestTransaction(id,
+   std::pmr::get_default_resource(), historyScope::ALL);
+   const rgb& color = (trans.fromId == id) ? RED : GREEN;
    println(trans.string(), color);
 }
 
-// Retrieve and print out all of the transactions.
+// Print out all of the transactions, a page at a time. Archived transactions
+// are only included if the user asks for them.
 inline void allTransactions(int id, Transactions& tr) {
-   for (transaction trans : tr.getTransactions(id)) {
-      std::string color = (trans.fromId == id) ? RED : GREEN;
-      println(trans.string(), color);
+   historyScope scope = (tr.hasArchives()
+   && getConsent("Include archived transactions? [y/n] > ", BLUE))
+   ? historyScope::ALL : historyScope::HOT;
+
+   // Reuse one line for every row, so long histories do not allocate per row.
+   std::string line;
+   tr.forEachTransaction(id, [&](const transaction& trans) {
+      line.clear();
+      trans.appendTo(line);
+      println(line, (trans.fromId == id) ? RED : GREEN);
+   }, scope);
+}
+
+// Print the days of a month that had transactions, the totals of the month
+// and the accounts the most money was moved with.
+inline void statement(int id, Transactions& tr) {
+   std::string month = getInput("Month (YYYY-MM, empty for this month) > ",
+   BLUE);
+   int64_t from, to;
+   if (!monthRange(month, from, to)) {
+      println("Month must look like YYYY-MM.", RED);
+      return;
+   }
+
+   std::string line;
+   for (reportPeriod period : {reportPeriod::DAY, reportPeriod::MONTH}) {
+      for (const periodTotal& total : tr.getSummary(id, from, to, period)) {
+         line.clear();
+         total.appendTo(line, period);
+         println(line, (total.net() < Money()) ? RED : GREEN);
+      }
+   }
+
+   println("Most money moved with:", BLUE);
+   for (const counterparty& party : tr.getCounterparties(id, from, to)) {
+      line.clear();
+      party.appendTo(line);
+      println(line);
    }
 }
 
 // Print users ballance.
-inline void getBalance(int balance) {
-   std::string color = (balance < 1) ? RED : GREEN;
+inline void getBalance(Money balance) {
+   const rgb& color = (balance < Money::dollars(1)) ? RED : GREEN;
    println("Balance: " + str(balance) + "$", color);
 }
 
@@ -0,0 +1,75 @@
+#pragma once
+#include <algorithm>
+#include <ctime>
+#include "../lib/columnar.hpp"
+
+// Amount of accounts listed by the analysis.
+const int TOP_ACCOUNTS = 10;
+
+// Export the database into a columnar file. Returns the exit code.
+inline int runExport(Connection& conn, const std::string& fileName) {
+   useColors = false;
+   if (!Exporter(conn).exportTo(fileName)) return 1;
+
+   println("Exported to '" + fileName + "'.");
+   return 0;
+}
+
+// Print the money moved per day and the accounts that moved the most, read
+// from a columnar export only. Returns the exit code.
+inline int runAnalysis(const std::string& fileName) {
+   useColors = false;
+   ColumnarReader reader;
+   if (!reader.open(fileName)) {
+      println("Could not read export '" + fileName + "'.");
+      return 1;
+   }
+
+   // Sums only overflow if the export is corrupt.
+   Money total;
+   std::vector<accountFlow> flows = reader.flowsPerAccount();
+   if (!reader.totalVolume(total) || flows.empty()) {
+      println("Export '" + fileName + "' holds amounts that do not add up.");
+      return 1;
+   }
+
+   println("accounts " + std::to_string(reader.accounts()) + ", transactions "
+   + std::to_string(reader.transactions()) + ", volume " + str(total) + "$");
+
+   // Money moved per day.
+   println("day count volume");
+   for (const dayFlow& day : reader.flowsPerDay()) {
+      char date[16];
+      time_t seconds = day.day * DAY_SECONDS;
+      struct tm utc;
+      gmtime_r(&seconds, &utc);
+      strftime(date, sizeof(date), "%Y-%m-%d", &utc);
+      println(str(date) + " " + std::to_string(day.count) + " "
+      + str(day.volume));
+   }
+
+   // Accounts that moved the most money, the bank excluded.
+   std::vector<size_t> rows;
+   std::span<const int32_t> ids = reader.accountIds();
+   for (size_t row = 0; row < ids.size(); row++) {
+      if (ids[row] != BANK_ID) rows.push_back(row);
+   }
+
+   auto volume = [&](size_t row) {
+      Money moved = flows[ids[row]].in;
+      moved.add(flows[ids[row]].out);
+      return moved;
+   };
+   size_t top = std::min(rows.size(), size_t(TOP_ACCOUNTS));
+   std::partial_sort(rows.begin(), rows.begin() + top, rows.end(),
+   [&](size_t first, size_t second) { return volume(first) > volume(second); });
+
+   println("account in out balance");
+   for (size_t i = 0; i < top; i++) {
+      const accountFlow& flow = flows[ids[rows[i]]];
+      println(std::string(reader.accountName(rows[i])) + " "
+      + str(flow.in) + " " + str(flow.out) + " "
+      + str(reader.balances()[rows[i]]));
+   }
+   return 0;
+}
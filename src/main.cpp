@@ -1,18 +1,140 @@
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include "../lib/backup.hpp"
 #include "actions.hpp"
+#include "analytics.hpp"
+#include "script.hpp"
+#include "server.hpp"
 
 // Pre-declare functions.
 account login(Accounts& db);
 account signup(Accounts& db);
+bool parseNumber(const char* text, std::string what, int& value,
+int least = 1);
 
-// Main loop.
-int main() {
-   Accounts db;
-   Transactions tr(db);
+// Main loop. Run with '--script <file>' to run the commands of a file instead,
+// '-' reads them from stdin. '--export <file>' writes a columnar copy of the
+// database for analytics and '--analyze <file>' summarizes such a copy.
+// '--serve <address> [workers] [archive days]' serves script commands over a
+// socket until stopped, archiving old transactions in the background if given
+// the days. '--archive <days>' archives transactions older than the days once.
+// '--backup <file> [pages per step] [pause us]' copies the database and its
+// archives while they are in use and verifies the copy, '--verify <file>' only
+// verifies an existing backup.
+// '--async' commits the transfers of the interactive actions in the
+// background. The operation metrics are written to a JSON file on the way out.
+int main(int argc, char* argv[]) {
+   // Analytics only reads the export, never the database.
+   if (argc > 2 && str(argv[1]) == "--analyze") return runAnalysis(argv[2]);
+
+   // Copy a few pages at a time, so this can run next to a server. Backups
+   // never write to the database, so they run before it is opened for the
+   // rest. The copy is only kept as a backup if it passes verification.
+   if (argc > 2 && str(argv[1]) == "--backup") {
+      int pages = BACKUP_PAGES_PER_STEP, pauseUs = BACKUP_PAUSE_US;
+      if ((argc > 3 && !parseNumber(argv[3], "amount of pages per step", pages))
+      || (argc > 4 && !parseNumber(argv[4], "pause in microseconds", pauseUs,
+      0))) {
+         return 1;
+      }
+      useColors = false;
+      Backup backup(DATABASE_FILE, pages, pauseUs);
+
+      // Report every tenth of a file.
+      std::string file;
+      int reported = -1;
+      bool copied = backup.copyTo(argv[2], [&](const backupProgress& step) {
+         int tenth = int(step.fraction() * 10);
+         if (step.file == file && tenth == reported) return;
+         file = step.file;
+         reported = tenth;
+         println("Backing up '" + file + "': " + str(step.copied) + " of "
+         + str(step.total) + " pages.");
+      });
+      if (!copied) return 1;
+   }
+
+   // Check that a backup restores to balances that match its ledger.
+   if (argc > 2 && (str(argv[1]) == "--backup" || str(argv[1]) == "--verify")) {
+      useColors = false;
+      std::vector<balanceDrift> drifts;
+      bool verified = Backup::verify(argv[2], &drifts);
+      for (balanceDrift& drift : drifts) println(drift.string(), RED);
+      println(str("Backup '") + argv[2] + "' "
+      + (verified ? "verified." : "failed verification."));
+      return verified ? 0 : 1;
+   }
+
+   Connection conn;
+   Accounts db(conn);
+   Transactions tr(conn, db);
+   Reconciler rec(conn);
 
    // Create BANK account as ID 1 if it does not exist yet. Set password to 'BANK'
-   // as you cannot log into an account with an unhashed password.
+   // as you cannot log into an account with an unhashed password. The age only
+   // has to pass validation.
    if (db.selectByName("BANK").id == INVALID_ID) {
-      db.createAccount(account("BANK", "BANK", 0, 0));
+      db.createAccount(account("BANK", "BANK", MIN_AGE, Money()));
+   }
+
+   // Snapshot the balances if the ledger grew enough since the last time.
+   rec.checkpointIfDue();
+
+   if (argc > 2 && str(argv[1]) == "--export") {
+      int code = runExport(conn, argv[2]);
+      writeMetrics(conn);
+      return code;
+   }
+
+   if (argc > 2 && str(argv[1]) == "--serve") {
+      int workers = SERVER_WORKERS, days = 0;
+      if ((argc > 3 && !parseNumber(argv[3], "amount of workers", workers))
+      || (argc > 4 && !parseNumber(argv[4], "archive age in days", days))) {
+         return 1;
+      }
+      int code = runServer(argv[2], workers, days);
+      writeMetrics(conn);
+      return code;
+   }
+
+   // Checkpoint first so every old transaction can be archived. Batches are
+   // small, so this can run next to a server.
+   if (argc > 2 && str(argv[1]) == "--archive") {
+      int days = 0;
+      if (!parseNumber(argv[2], "archive age in days", days)) return 1;
+      useColors = false;
+      Archiver archiver(DATABASE_FILE, days);
+      long long moved = rec.checkpoint() ? archiver.archiveOld() : -1;
+      if (moved >= 0) {
+         println("Archived " + std::to_string(moved) + " transactions in "
+         + std::to_string(archiver.commits()) + " batches.");
+      }
+      writeMetrics(conn);
+      return (moved < 0) ? 1 : 0;
+   }
+
+   // Run a script without a terminal.
+   if (argc > 2 && str(argv[1]) == "--script") {
+      std::ifstream file;
+      if (str(argv[2]) != "-") file.open(argv[2]);
+
+      if (str(argv[2]) != "-" && !file) {
+         println("Could not open script '" + str(argv[2]) + "'.", RED);
+         return 1;
+      }
+
+      int code = runScript(file.is_open() ? file : std::cin, db, tr, rec);
+      writeMetrics(conn);
+      return code;
+   }
+
+   // The queue and this connection write at the same time, so this one waits
+   // for the queue instead of failing.
+   std::unique_ptr<TransferQueue> queue;
+   if (argc > 1 && str(argv[1]) == "--async") {
+      waitWhenBusy(conn);
+      queue = std::make_unique<TransferQueue>(db);
    }
 
    // Log in or sign up.
@@ -24,33 +146,45 @@ int main() {
    println("\nWelcome, " + acc.name + "!", BLUE);
    println("What would you like to do today?", BLUE);
 
-   // Action loop.
+   // Action loop. Account reloads are allocated from an arena that is freed
+   // before every command.
+   RequestArena arena;
    while (true) {
+      arena.release();
       switch (getKey("Command (h for help) > ")) {
       case 'h': 
          help(); 
          break;
       case 'q':
          println("Quitting.", BLUE);
+         if (queue) queue->drain();
+         writeMetrics(conn);
          exit(0);
+      case 'm':
+         // Hidden, prints the operation metrics.
+         printMetrics(conn);
+         break;
       case 'd':
-         deposit(acc.id, tr);
-         acc = db.selectById(acc.id).at(0);
+         deposit(acc.id, tr, queue.get());
+         acc = db.selectById(acc.id, "=", arena.resource()).at(0);
          break;
       case 'w':
-         withdraw(acc, tr);
-         acc = db.selectById(acc.id).at(0);
+         withdraw(acc, tr, queue.get());
+         acc = db.selectById(acc.id, "=", arena.resource()).at(0);
          break;
       case 'e':
          editAccount(acc, db);
 
          // If user deleted account then reload the program.
-         if (acc.name == "DELETED") return main();
-         acc = db.selectById(acc.id).at(0);
+         if (acc.name == "DELETED") {
+            queue.reset();
+            return main(argc, argv);
+         }
+         acc = db.selectById(acc.id, "=", arena.resource()).at(0);
          break;
       case 't':
-         createTransaction(acc, db, tr);
-         acc = db.selectById(acc.id).at(0);
+         createTransaction(acc, db, tr, queue.get());
+         acc = db.selectById(acc.id, "=", arena.resource()).at(0);
          break;
       case 'r':
          lastTransaction(acc.id, tr);
@@ -61,8 +195,14 @@ int main() {
       case 'b':
          getBalance(acc.balance);
          break;
+      case 's':
+         statement(acc.id, tr);
+         break;
       case 'o':
-         if (logout(acc)) return main();
+         if (logout(acc)) {
+            queue.reset();
+            return main(argc, argv);
+         }
          break;
       default:
          // Unknown command.
@@ -93,7 +233,7 @@ account login(Accounts& db) {
       }
 
       // Check if passwords match.
-      if (acc.pass == hashString(password)) {
+      if (db.authenticate(acc, password)) {
          println("Logged into '" + acc.string() + "'.", GREEN);
          return acc;
       } else {
@@ -126,7 +266,8 @@ account signup(Accounts& db) {
       // Handle all of the other edge cases in the create account function, the
       // password length cannot be checked there because it has to be hashed and
       // hashed string length is fixed.
-      if (db.createAccount(account(username, hashString(password), age, 0))) {
+      if (db.createAccount(account(username, hashPassword(password), age,
+      Money()))) {
          acc = db.selectByName(username);
          println("Signed up as '" + acc.string() + "'.", GREEN);
          return acc;
@@ -134,4 +275,20 @@ account signup(Accounts& db) {
    }
 
    return account();
-}
\ No newline at end of file
+}
+
+// Parse a number from the command line, it has to be a whole number of at
+// least the given one. Prints an error naming what the number is for otherwise.
+bool parseNumber(const char* text, std::string what, int& value, int least) {
+   const char* end = text + strlen(text);
+   int parsed = 0;
+   auto [next, error] = std::from_chars(text, end, parsed);
+   if (error != std::errc() || next != end || parsed < least) {
+      println("The " + what + " must be a whole number of at least "
+      + str(least) + ", not '" + str(text) + "'.", RED);
+      return false;
+   }
+
+   value = parsed;
+   return true;
+}
@@ -0,0 +1,272 @@
+#pragma once
+#include <chrono>
+#include <istream>
+#include <map>
+#include <sstream>
+#include "../lib/reconcile.hpp"
+
+// Latency and memory totals of a single kind of command.
+struct opStats {
+   long long count, failed, allocations, bytes;
+   double totalUs, maxUs;
+
+   opStats()
+   : count(0), failed(0), allocations(0), bytes(0), totalUs(0), maxUs(0) {}
+};
+
+// A logged in user running commands without a terminal. Every command is a
+// single line, words are separated by spaces:
+// signup <name> <password> <age>, login <name> <password>, logout,
+// deposit <amount>, withdraw <amount>, transfer <name> <amount>, balance,
+// last [all], list [all], statement [YYYY-MM], audit. History commands only
+// read the archives when given 'all'.
+class Session {
+public:
+   // Use the given tables. Sessions that never run at the same time can share
+   // an arena, otherwise the session makes its own.
+   Session(Accounts& db, Transactions& tr, Reconciler& rec,
+   RequestArena* shared = nullptr)
+   : db(db), tr(tr), rec(rec),
+   own(shared ? nullptr : std::make_unique<RequestArena>()),
+   arena(shared ? *shared : *own) {}
+
+   // Run a single command, its output is appended to result. Returns whether
+   // the command succeeded. Query results of the command are allocated from
+   // the session's arena, which is freed when the next command starts.
+   bool execute(const std::string& line, std::string& result) {
+      // Errors the tables print belong to the output of the command.
+      capturedPrints capture(result);
+      return run(line, result);
+   }
+
+   // Get the memory used by the commands so far.
+   const RequestArena& memory() const {
+      return arena;
+   }
+
+private:
+   Accounts& db;
+   Transactions& tr;
+   Reconciler& rec;
+   std::unique_ptr<RequestArena> own;
+   RequestArena& arena;
+   account acc;
+
+   // Run a single command, see execute.
+   bool run(const std::string& line, std::string& result) {
+      arena.release();
+      std::istringstream words(line);
+      std::string command;
+      words >> command;
+
+      if (command == "signup") return signup(words, result);
+      if (command == "login") return login(words, result);
+      if (command == "audit") return audit(result);
+
+      if (command != "logout" && command != "deposit" && command != "withdraw"
+      && command != "transfer" && command != "balance" && command != "last"
+      && command != "list" && command != "statement") {
+         result += "Unknown command '" + command + "'.";
+         return false;
+      }
+
+      // Everything else needs a logged in user.
+      if (acc.id == INVALID_ID) {
+         result += "Not logged in.";
+         return false;
+      }
+
+      if (command == "logout") {
+         acc = account();
+         return true;
+      }
+      if (command == "balance") {
+         result += "Balance: " + str(acc.balance) + "$";
+         return true;
+      }
+      if (command == "statement") return statement(words, result);
+      if (command == "last" || command == "list") return history(command, words,
+      result);
+
+      // Commands that move money, amounts are dollars with up to two
+      // decimals.
+      bool sent = false;
+      std::string name, text;
+      Money amount;
+      if (command == "transfer") words >> name;
+      if (!(words >> text) || !Money::parse(text, amount)) {
+         result += "Missing amount.";
+         return false;
+      }
+
+      if (command == "deposit") {
+         sent = tr.createTransaction(transaction(amount, BANK_ID, acc.id));
+      }
+      else if (command == "withdraw") {
+         sent = tr.createTransaction(transaction(amount, acc.id, BANK_ID));
+      }
+      else {
+         account receiver = db.selectByName(name, arena.resource());
+         if (receiver.id == INVALID_ID) {
+            result += "Could not find user '" + name + "'.";
+            return false;
+         }
+         sent = tr.createTransaction(transaction(amount, acc.id, receiver.id));
+      }
+
+      acc = db.selectById(acc.id, "=", arena.resource()).at(0);
+      return sent;
+   }
+
+   // Check every balance against the ledger, listing the accounts that drifted.
+   bool audit(std::string& result) {
+      std::vector<balanceDrift> drifts = rec.audit();
+      for (balanceDrift& drift : drifts) {
+         if (!result.empty()) result += "\n";
+         result += drift.string();
+      }
+      return drifts.empty();
+   }
+
+   // Print the latest or every transaction of the user, the archived ones
+   // too if the command is followed by 'all'.
+   bool history(const std::string& command, std::istringstream& words,
+   std::string& result) {
+      std::string scope;
+      words >> scope;
+      historyScope read = (scope == "all")
+      ? historyScope::ALL : historyScope::HOT;
+
+      if (command == "last") {
+         result += tr.getLatestTransaction(acc.id, arena.resource(),
+         read).string();
+         return true;
+      }
+      tr.forEachTransaction(acc.id, [&](const transaction& trans) {
+         if (!result.empty()) result += "\n";
+         result += trans.string();
+      }, read);
+      return true;
+   }
+
+   // List the days of a month that had transactions, the totals of the month
+   // and the accounts the most money was moved with. Defaults to the current
+   // month.
+   bool statement(std::istringstream& words, std::string& result) {
+      std::string month;
+      words >> month;
+      int64_t from, to;
+      if (!monthRange(month, from, to)) {
+         result += "Month must look like YYYY-MM.";
+         return false;
+      }
+
+      for (reportPeriod period : {reportPeriod::DAY, reportPeriod::MONTH}) {
+         for (const periodTotal& total : tr.getSummary(acc.id, from, to, period,
+         arena.resource())) {
+            if (!result.empty()) result += "\n";
+            total.appendTo(result, period);
+         }
+      }
+      for (const counterparty& party : tr.getCounterparties(acc.id, from, to,
+      TOP_COUNTERPARTIES, arena.resource())) {
+         if (!result.empty()) result += "\n";
+         party.appendTo(result);
+      }
+      return true;
+   }
+
+   // Log into an existing account.
+   bool login(std::istringstream& words, std::string& result) {
+      std::string name, password;
+      words >> name >> password;
+
+      account found = db.selectByName(name, arena.resource());
+      if (found.id == INVALID_ID || !db.authenticate(found, password)) {
+         result += "Incorrect username or password.";
+         return false;
+      }
+
+      acc = found;
+      result += "Logged into '" + acc.string() + "'.";
+      return true;
+   }
+
+   // Create a new account and log into it.
+   bool signup(std::istringstream& words, std::string& result) {
+      std::string name, password;
+      int age = -1;
+      words >> name >> password >> age;
+
+      // Password is within the length bounds.
+      if (password.size() < MIN_PASS_SIZE || password.size() > MAX_PASS_SIZE) {
+         result += "Password is either too short or too long.";
+         return false;
+      }
+
+      if (!db.createAccount(account(name, hashPassword(password), age,
+      Money()))) {
+         return false;
+      }
+
+      acc = db.selectByName(name, arena.resource());
+      result += "Signed up as '" + acc.string() + "'.";
+      return true;
+   }
+};
+
+// Run every command of a script, printing the output and latency of each one
+// followed by a summary per command, with the arena allocations and bytes the
+// command used on average. Colors and raw terminal input are never used.
+// Returns the exit code, non zero if any command failed.
+inline int runScript(std::istream& input, Accounts& db, Transactions& tr,
+Reconciler& rec) {
+   useColors = false;
+   Session session(db, tr, rec);
+   std::map<std::string, opStats> stats;
+   bool failed = false;
+   std::string line;
+
+   while (std::getline(input, line)) {
+      // Skip empty lines and comments.
+      if (line.empty() || line[0] == '#') continue;
+
+      std::string command = line.substr(0, line.find(' '));
+      std::string result;
+
+      long long allocations = session.memory().usage().allocations();
+      long long bytes = session.memory().usage().bytes();
+      auto start = std::chrono::steady_clock::now();
+      bool ok = session.execute(line, result);
+      auto end = std::chrono::steady_clock::now();
+      double us = std::chrono::duration<double, std::micro>(end - start).count();
+
+      // Record latency of the command.
+      opStats& op = stats[command];
+      op.count++;
+      op.totalUs += us;
+      op.maxUs = std::max(op.maxUs, us);
+      op.allocations += session.memory().usage().allocations() - allocations;
+      op.bytes += session.memory().usage().bytes() - bytes;
+      if (!ok) op.failed++;
+      failed = failed || !ok;
+
+      println(line + " -> " + (ok ? "ok" : "failed") + " (" + str(int(us))
+      + "us)");
+      if (!result.empty()) println(result);
+   }
+
+   // Print the summary.
+   println("command count failed avg_us max_us avg_allocs avg_bytes");
+   for (auto& [command, op] : stats) {
+      println(command + " " + str(int(op.count)) + " " + str(int(op.failed))
+      + " " + str(int(op.totalUs / op.count)) + " " + str(int(op.maxUs))
+      + " " + str(int(op.allocations / op.count)) + " "
+      + str(int(op.bytes / op.count)));
+   }
+   const CountingResource& spills = session.memory().spills();
+   println("arena heap spills " + str(int(spills.allocations())) + ", peak "
+   + str(int(spills.peak())) + " bytes");
+
+   return failed ? 1 : 0;
+}
@@ -0,0 +1,394 @@
+#pragma once
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <csignal>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>
+#include "../lib/archive.hpp"
+#include "../lib/network.hpp"
+#include "script.hpp"
+
+// Default amount of threads running database work.
+const int SERVER_WORKERS = 4;
+
+// Most events handled per wait of the event loop.
+const int MAX_EVENTS = 256;
+
+// Bytes read from a socket at once.
+const size_t READ_CHUNK = 64 * 1024;
+
+// A connected client. Its session is only run by the worker it is pinned to,
+// so its commands run one at a time and in order. Everything else is only
+// touched by the event loop. A client that stopped sending is closed once
+// every command it sent was answered.
+struct serverClient {
+   int fd, worker;
+   bool closed, writing, ended;
+   std::string input, output;
+   size_t sent;
+   int queued;
+   std::unique_ptr<Session> session;
+
+   serverClient(int fd, int worker)
+   : fd(fd), worker(worker), closed(false), writing(false), ended(false),
+   sent(0), queued(0) {}
+};
+
+// A command waiting for a worker, or a finished response waiting to be sent.
+struct serverJob {
+   std::shared_ptr<serverClient> client;
+   std::string data;
+};
+
+// A thread running commands with its own connection and tables. The account
+// cache is shared by every worker, so they all see each others changes.
+class ServerWorker {
+public:
+   // Open a connection to the file, done is called with the framed response
+   // of every command from the worker thread.
+   ServerWorker(const std::string& fileName, AccountCache& cache,
+   std::function<void(serverJob)> done)
+   : conn(fileName), db(conn, cache), tr(conn, db), rec(conn), done(done),
+   stopping(false) {
+      waitWhenBusy(conn);
+      thread = std::thread([this]() { run(); });
+   }
+
+   // Finish the commands that are already queued, then stop.
+   ~ServerWorker() {
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         stopping = true;
+      }
+      ready.notify_one();
+      thread.join();
+   }
+
+   // Create a session on the tables of this worker.
+   std::unique_ptr<Session> open() {
+      return std::make_unique<Session>(db, tr, rec, &arena);
+   }
+
+   // Queue a command of a client pinned to this worker.
+   void submit(serverJob job) {
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         jobs.push_back(std::move(job));
+      }
+      ready.notify_one();
+   }
+
+private:
+   Connection conn;
+   Accounts db;
+   Transactions tr;
+   Reconciler rec;
+   RequestArena arena;
+   std::function<void(serverJob)> done;
+
+   std::mutex mutex;
+   std::condition_variable ready;
+   std::deque<serverJob> jobs;
+   bool stopping;
+   std::thread thread;
+
+   // Run queued commands until stopped.
+   void run() {
+      while (true) {
+         serverJob job;
+         {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [&]() { return stopping || !jobs.empty(); });
+            if (jobs.empty()) return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+         }
+
+         // The status goes in front of the output of the command.
+         std::string output;
+         bool ok = job.client->session->execute(job.data, output);
+         std::string result(1, ok ? STATUS_OK : STATUS_FAILED);
+         result += output;
+
+         job.data.clear();
+         appendFrame(job.data, result);
+         done(std::move(job));
+      }
+   }
+};
+
+// Serves sessions over a socket. Every request is a frame holding a single
+// script command, see Session, and is answered with a frame holding the
+// status and the output of the command. A single thread waits for every
+// socket with epoll, reads and writes them, and hands the commands to the
+// workers.
+class Server {
+public:
+   // Listen on the address, see openSocket, and open a connection to the
+   // file for every worker. Exits if the address cannot be used.
+   Server(const std::string& address, int workerCount,
+   const std::string& fileName = DATABASE_FILE)
+   : next(0), requests(0), accepted(0) {
+      listener = openSocket(address, true);
+      if (listener < 0 || !setNonBlocking(listener)) {
+         println("Fatal error: Could not listen on '" + address + "'.", RED);
+         exit(-5);
+      }
+
+      // Signals are read from the loop, the workers inherit the blocked mask.
+      sigset_t mask;
+      sigemptyset(&mask);
+      sigaddset(&mask, SIGINT);
+      sigaddset(&mask, SIGTERM);
+      pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+      signals = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+      wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      poll = epoll_create1(EPOLL_CLOEXEC);
+      watch(listener, EPOLLIN, EPOLL_CTL_ADD);
+      watch(wakeup, EPOLLIN, EPOLL_CTL_ADD);
+      watch(signals, EPOLLIN, EPOLL_CTL_ADD);
+
+      for (int i = 0; i < std::max(1, workerCount); i++) {
+         workers.push_back(std::make_unique<ServerWorker>(fileName, cache,
+            [this](serverJob job) { finish(std::move(job)); }
+         ));
+      }
+   }
+
+   ~Server() {
+      // Stop the workers before the sockets they answer go away.
+      workers.clear();
+      for (auto& [fd, client] : clients) ::close(fd);
+      ::close(listener);
+      ::close(wakeup);
+      ::close(signals);
+      ::close(poll);
+   }
+
+   // Serve clients until SIGINT or SIGTERM. Returns the exit code.
+   int run() {
+      auto start = std::chrono::steady_clock::now();
+      epoll_event events[MAX_EVENTS];
+      bool running = true;
+
+      while (running) {
+         int count = epoll_wait(poll, events, MAX_EVENTS, -1);
+         for (int i = 0; i < count; i++) {
+            int fd = events[i].data.fd;
+            if (fd == listener) acceptClients();
+            else if (fd == wakeup) sendFinished();
+            else if (fd == signals) running = false;
+            else {
+               auto found = clients.find(fd);
+               if (found == clients.end()) continue;
+               std::shared_ptr<serverClient> client = found->second;
+               if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                  receive(client);
+               }
+               if (!client->closed && (events[i].events & EPOLLOUT)) {
+                  send(client);
+               }
+            }
+         }
+      }
+
+      double seconds = std::chrono::duration<double>(
+         std::chrono::steady_clock::now() - start).count();
+      println("Served " + std::to_string(requests) + " requests from "
+      + std::to_string(accepted) + " clients in " + str(int(seconds))
+      + "s.");
+      return 0;
+   }
+
+private:
+   int listener, signals, wakeup, poll;
+   AccountCache cache;
+   std::vector<std::unique_ptr<ServerWorker>> workers;
+   std::unordered_map<int, std::shared_ptr<serverClient>> clients;
+   int next;
+   long long requests, accepted;
+
+   // Responses finished by the workers, sent by the loop.
+   std::mutex mutex;
+   std::vector<serverJob> finished;
+
+   // Add or change the events a socket is watched for.
+   void watch(int fd, uint32_t events, int op) {
+      epoll_event event{};
+      event.events = events;
+      event.data.fd = fd;
+      epoll_ctl(poll, op, fd, &event);
+   }
+
+   // Accept every waiting client and pin it to the next worker.
+   void acceptClients() {
+      while (true) {
+         int fd = accept4(listener, nullptr, nullptr,
+         SOCK_NONBLOCK | SOCK_CLOEXEC);
+         if (fd < 0) return;
+
+         int on = 1;
+         setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+         auto client = std::make_shared<serverClient>(fd, next);
+         client->session = workers[next]->open();
+         next = (next + 1) % workers.size();
+         clients.emplace(fd, client);
+         watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+         accepted++;
+      }
+   }
+
+   // Read what the client sent and queue every whole command in it. Once the
+   // client stops sending, the commands it sent last are still answered. A
+   // client that ended is only watched for writing, so getting here again
+   // means it hung up completely.
+   void receive(std::shared_ptr<serverClient>& client) {
+      if (client->ended) {
+         close(client);
+         return;
+      }
+
+      char chunk[READ_CHUNK];
+      while (true) {
+         ssize_t got = recv(client->fd, chunk, sizeof(chunk), 0);
+         if (got > 0) {
+            client->input.append(chunk, got);
+            continue;
+         }
+         if (got < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+         if (got < 0 && errno == EINTR) continue;
+         if (got < 0) {
+            close(client);
+            return;
+         }
+         client->ended = true;
+         break;
+      }
+
+      size_t offset = 0;
+      std::string_view payload;
+      int status;
+      while ((status = nextFrame(client->input, offset, payload)) == 1) {
+         workers[client->worker]->submit({ client, std::string(payload) });
+         client->queued++;
+         requests++;
+      }
+      client->input.erase(0, offset);
+      if (status < 0) close(client);
+      else if (client->ended) {
+         watch(client->fd, events(client), EPOLL_CTL_MOD);
+         if (answered(client)) close(client);
+      }
+   }
+
+   // Called by the workers, hands a response to the loop.
+   void finish(serverJob job) {
+      bool first;
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         first = finished.empty();
+         finished.push_back(std::move(job));
+      }
+      uint64_t one = 1;
+      if (first && write(wakeup, &one, sizeof(one)) < 0) {}
+   }
+
+   // Queue the finished responses on their clients and send them.
+   void sendFinished() {
+      uint64_t count;
+      if (read(wakeup, &count, sizeof(count)) < 0) {}
+
+      std::vector<serverJob> done;
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         done.swap(finished);
+      }
+
+      for (serverJob& job : done) {
+         job.client->queued--;
+         if (job.client->closed) continue;
+         job.client->output += job.data;
+      }
+      for (serverJob& job : done) {
+         if (!job.client->closed && !job.client->writing) send(job.client);
+      }
+   }
+
+   // Send as much of the queued output as the socket takes, and watch it for
+   // room while some is left.
+   void send(std::shared_ptr<serverClient>& client) {
+      while (client->sent < client->output.size()) {
+         ssize_t put = ::send(client->fd, client->output.data() + client->sent,
+         client->output.size() - client->sent, MSG_NOSIGNAL);
+         if (put > 0) {
+            client->sent += put;
+            continue;
+         }
+         if (put < 0 && errno == EINTR) continue;
+         if (put < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+         close(client);
+         return;
+      }
+
+      bool pending = client->sent < client->output.size();
+      if (!pending) {
+         client->output.clear();
+         client->sent = 0;
+      }
+      if (pending != client->writing) {
+         client->writing = pending;
+         watch(client->fd, events(client), EPOLL_CTL_MOD);
+      }
+      if (answered(client)) close(client);
+   }
+
+   // Get the events a client is watched for, reading stops once it ended.
+   static uint32_t events(const std::shared_ptr<serverClient>& client) {
+      uint32_t events = 0;
+      if (!client->ended) events |= EPOLLIN;
+      if (client->writing) events |= EPOLLOUT;
+      return events;
+   }
+
+   // Whether a client that ended got the response to every command it sent.
+   static bool answered(const std::shared_ptr<serverClient>& client) {
+      return client->ended && client->queued == 0
+      && client->output.empty();
+   }
+
+   // Drop a client. Commands it still has queued run, but nothing is sent.
+   void close(std::shared_ptr<serverClient> client) {
+      if (client->closed) return;
+      client->closed = true;
+      epoll_ctl(poll, EPOLL_CTL_DEL, client->fd, nullptr);
+      clients.erase(client->fd);
+      ::close(client->fd);
+   }
+};
+
+// Serve sessions on the address with the given amount of workers until
+// stopped. Transactions older than archiveDays are archived in the background
+// if it is above 0. Returns the exit code.
+inline int runServer(const std::string& address, int workers,
+int archiveDays = 0) {
+   useColors = false;
+   raiseFileLimit();
+   Server server(address, workers);
+   println("Serving on '" + address + "' with " + str(std::max(1, workers))
+   + " workers.");
+
+   std::unique_ptr<Archiver> archiver;
+   if (archiveDays > 0) {
+      archiver = std::make_unique<Archiver>(DATABASE_FILE, archiveDays);
+      archiver->start();
+      println("Archiving transactions older than " + str(archiveDays)
+      + " days.");
+   }
+   flush();
+   return server.run();
+}